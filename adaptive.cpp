@@ -0,0 +1,151 @@
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "adaptive.h"
+#include "metrics.h"
+#include "timestamps.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace prometheus;
+
+#define PORT_REF(group, field) \
+    { offsetof(struct NtPortStatistics_v2_s, group.field), offsetof(struct NtPortStatistics_v2_s, valid.group) }
+
+const CounterRef ADAPTIVE_DROPS[] = {
+    PORT_REF(RMON1, dropEvents),
+    PORT_REF(extDrop, pktsOverflow),
+    PORT_REF(extDrop, pktsMacBandwidth),
+};
+const size_t ADAPTIVE_DROPS_COUNT = sizeof(ADAPTIVE_DROPS) / sizeof(ADAPTIVE_DROPS[0]);
+
+// RX direction
+static const size_t RX = 0;
+
+// Visits every drop counter in the order of AdaptiveController::previous_drops, invalid ones as 0
+template <typename Visit>
+static void forEachDrop(const NtStatistics_t &hStat, const int ports_count, Visit visit)
+{
+    const QueryResult &data = hStat.u.query_v3.data;
+
+    visit(data.stream.Unassigned.drop.pkts);
+
+    for (int p = 0; p < ports_count; p++)
+    {
+        const size_t base = portOffset(p, RX);
+        for (size_t d = 0; d < ADAPTIVE_DROPS_COUNT; d++)
+        {
+            if (counterValid(reinterpret_cast<const char *>(&data) + base, ADAPTIVE_DROPS[d].valid_offset))
+                visit(counterAt(&data, base + ADAPTIVE_DROPS[d].offset));
+            else
+                visit(0);
+        }
+    }
+
+    for (const auto &stream : data.stream.streamid)
+        visit(stream.drop.pkts);
+}
+
+// Deltas are taken per counter, so one counter being reset doesn't count the others as new drops
+static bool dropsMoved(AdaptiveController &adaptive, const NtStatistics_t &hStat, const int ports_count)
+{
+    bool moved = false;
+    size_t i = 0;
+
+    forEachDrop(hStat, ports_count, [&](const uint64_t drops) {
+        if (counterDelta(drops, adaptive.previous_drops[i++]) > 0)
+            moved = true;
+    });
+
+    return moved;
+}
+
+// Also reseeds the drops, so ports appearing or going away don't count as a drop spike
+static void seedPorts(AdaptiveController &adaptive, const NtStatistics_t &hStat, const int ports_count)
+{
+    adaptive.previous_drops.clear();
+    forEachDrop(hStat, ports_count, [&](const uint64_t drops) { adaptive.previous_drops.push_back(drops); });
+    adaptive.previous_ts.resize(ports_count);
+    adaptive.previous_octets.resize(ports_count);
+    adaptive.previous_rates.assign(ports_count, 0);
+
+    for (int p = 0; p < ports_count; p++)
+    {
+        adaptive.previous_ts[p] = hStat.u.query_v3.data.port.aPorts[p].ts;
+        adaptive.previous_octets[p] = hStat.u.query_v3.data.port.aPorts[p].rx.RMON1.octets;
+    }
+}
+
+void openAdaptiveController(AdaptiveController &adaptive, Family<Gauge> &gauge_family, const int slow_period_ms,
+                            const int fast_period_ms, const int cooldown_ms, const NtStatistics_t &hStat,
+                            const int ports_count)
+{
+    adaptive.slow_period = std::chrono::milliseconds(slow_period_ms);
+    adaptive.fast_period = std::chrono::milliseconds(fast_period_ms);
+    adaptive.cooldown = std::chrono::milliseconds(cooldown_ms);
+    adaptive.hold_until = std::chrono::steady_clock::now();
+    adaptive.escalations = 0;
+    adaptive.escalations_gauge = &gauge_family.Add({{"scheduler", "escalations"}, {"collector", "counters"}});
+
+    seedPorts(adaptive, hStat, ports_count);
+}
+
+std::chrono::milliseconds adaptSamplingPeriod(AdaptiveController &adaptive, const NtStatistics_t &hStat,
+                                              const int ports_count, const double interval)
+{
+    const auto now = std::chrono::steady_clock::now();
+    bool volatile_traffic = false;
+
+    if (adaptive.previous_octets.size() != static_cast<size_t>(ports_count))
+    {
+        seedPorts(adaptive, hStat, ports_count);
+    }
+    else
+    {
+        volatile_traffic = dropsMoved(adaptive, hStat, ports_count);
+
+        for (int p = 0; p < ports_count; p++)
+        {
+            const auto &port = hStat.u.query_v3.data.port.aPorts[p];
+
+            // Reads faster than ntservice refreshes the counters return the same sample again, only a new one
+            // gives a rate. Ports without time stamps fall back to the host interval.
+            if (port.ts == adaptive.previous_ts[p] && port.ts != 0)
+                continue;
+
+            // A first time stamp, or one going backwards, only seeds the port
+            const bool seeded = port.ts == 0 || adaptive.previous_ts[p] != 0;
+            const double seconds = port.ts != 0 ? timestampToSeconds(port.ts, port.tsType) -
+                                                      timestampToSeconds(adaptive.previous_ts[p], port.tsType)
+                                                : interval;
+            adaptive.previous_ts[p] = port.ts;
+            if (!seeded || seconds <= 0)
+            {
+                adaptive.previous_octets[p] = port.rx.RMON1.octets;
+                continue;
+            }
+
+            const double rate = counterDelta(port.rx.RMON1.octets, adaptive.previous_octets[p]) / seconds;
+            const double previous = adaptive.previous_rates[p];
+
+            if (std::max(rate, previous) >= ADAPTIVE_MIN_RATE &&
+                std::fabs(rate - previous) > ADAPTIVE_RATE_CHANGE * std::max(rate, previous))
+                volatile_traffic = true;
+            adaptive.previous_rates[p] = rate;
+        }
+    }
+
+    if (volatile_traffic)
+    {
+        if (now >= adaptive.hold_until)
+            adaptive.escalations_gauge->Set(++adaptive.escalations);
+        adaptive.hold_until = now + adaptive.cooldown;
+    }
+
+    return now < adaptive.hold_until ? adaptive.fast_period : adaptive.slow_period;
+}
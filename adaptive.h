@@ -0,0 +1,47 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "derived.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace prometheus;
+
+// Relative change of a port's RX byte rate between two intervals that escalates sampling
+const double ADAPTIVE_RATE_CHANGE = 0.5;
+
+// Byte rate below which a port's rate changes are ignored, 10 Mbit/s
+const double ADAPTIVE_MIN_RATE = 1.25e6;
+
+// Switches the counters tier between a slow and a fast period. Any drop or overflow, or a sharp change of a
+// port's RX rate, selects the fast period until cooldown has passed without another one.
+struct AdaptiveController
+{
+    std::chrono::milliseconds slow_period;
+    std::chrono::milliseconds fast_period;
+    std::chrono::milliseconds cooldown;
+    std::chrono::steady_clock::time_point hold_until; // Fast period end, in the past when sampling slowly
+    std::vector<uint64_t> previous_drops;             // Unassigned, ADAPTIVE_DROPS per port, then stream drops
+    std::vector<uint64_t> previous_ts;                // Sample time stamp of previous_octets per port
+    std::vector<uint64_t> previous_octets;            // RX octets per port
+    std::vector<double> previous_rates;               // RX byte rate per port
+    uint64_t escalations;
+    Gauge *escalations_gauge;
+};
+
+// Port RX counters that escalate sampling whenever they increase, along with every stream drop counter
+extern const CounterRef ADAPTIVE_DROPS[];
+extern const size_t ADAPTIVE_DROPS_COUNT;
+
+void openAdaptiveController(AdaptiveController &adaptive, Family<Gauge> &gauge_family, const int slow_period_ms,
+                            const int fast_period_ms, const int cooldown_ms, const NtStatistics_t &hStat,
+                            const int ports_count);
+
+// Returns the period until the next counters cycle, interval is the one just measured in seconds
+std::chrono::milliseconds adaptSamplingPeriod(AdaptiveController &adaptive, const NtStatistics_t &hStat,
+                                              const int ports_count, const double interval);
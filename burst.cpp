@@ -0,0 +1,242 @@
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "burst.h"
+#include "discovery.h"
+#include "metrics.h"
+#include "timestamps.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace prometheus;
+
+#define BURST_PORT_COUNTER(field, type, name, threshold) \
+    { offsetof(struct NtPortStatistics_v2_s, RMON1.field), type, name, threshold }
+
+const BurstDescriptor BURST_PORT_COUNTERS[] = {
+    BURST_PORT_COUNTER(pkts, "pkts_peak_rate", "total", BURST_NO_THRESHOLD),
+    BURST_PORT_COUNTER(octets, "bytes_peak_rate", "total", BURST_RATE_THRESHOLD),
+};
+const size_t BURST_PORT_COUNTERS_COUNT = sizeof(BURST_PORT_COUNTERS) / sizeof(BURST_PORT_COUNTERS[0]);
+
+#define BURST_STREAM_COUNTER(block, field, type, name, threshold) \
+    { offsetof(struct NtStatGroupStream_s, streamid[0].block.field), type, name, threshold }
+
+const BurstDescriptor BURST_STREAM_COUNTERS[] = {
+    BURST_STREAM_COUNTER(forward, pkts, "pkts_peak_rate", "forward", BURST_NO_THRESHOLD),
+    BURST_STREAM_COUNTER(forward, octets, "bytes_peak_rate", "forward", BURST_RATE_THRESHOLD),
+    BURST_STREAM_COUNTER(drop, pkts, "pkts_peak_rate", "drop", BURST_ANY_INCREASE),
+    BURST_STREAM_COUNTER(drop, octets, "bytes_peak_rate", "drop", BURST_NO_THRESHOLD),
+};
+const size_t BURST_STREAM_COUNTERS_COUNT = sizeof(BURST_STREAM_COUNTERS) / sizeof(BURST_STREAM_COUNTERS[0]);
+
+static int readSample(BurstSampler &burst)
+{
+    burst.hStat->cmd = NT_STATISTICS_READ_CMD_QUERY_V3;
+    burst.hStat->u.query_v3.poll = 1;  // The the current counters
+    burst.hStat->u.query_v3.clear = 0; // Do not clear statistics
+
+    return NT_StatRead(burst.hStatStream, burst.hStat.get());
+}
+
+// Hardware time stamps of the last read, in the BurstSampler::clocks layout
+static void readClocks(const BurstSampler &burst, std::vector<double> &clocks)
+{
+    const QueryResult &data = burst.hStat->u.query_v3.data;
+    const int ports_count = burst.topology.ports_count;
+
+    clocks.resize(ports_count + 1);
+    for (int p = 0; p < ports_count; p++)
+        clocks[p] = timestampToSeconds(data.port.aPorts[p].ts, data.port.aPorts[p].tsType);
+
+    // stream.ts has no type of its own, it follows the adapter TimestampFormat like the port time stamps
+    clocks[ports_count] = ports_count > 0 ? timestampToSeconds(data.stream.ts, data.port.aPorts[0].tsType) : 0;
+}
+
+static void addSeries(BurstSampler &burst, const BurstDescriptor &descriptor, const size_t offset, const size_t clock,
+                      const Labels &labels)
+{
+    BurstSeries series;
+    Labels peak_labels = labels;
+
+    peak_labels[descriptor.type] = descriptor.name;
+    series.offset = offset;
+    series.clock = clock;
+    series.threshold = descriptor.threshold;
+    series.previous = counterAt(&burst.hStat->u.query_v3.data, offset);
+    series.peak = 0;
+    series.above = 0;
+    series.peak_gauge = &burst.gauge_family->Add(peak_labels);
+    series.above_gauge = nullptr;
+
+    if (descriptor.threshold != BURST_NO_THRESHOLD)
+    {
+        Labels above_labels = labels;
+        above_labels["above_threshold_seconds"] = descriptor.name;
+        series.above_gauge = &burst.gauge_family->Add(above_labels);
+    }
+
+    burst.series.push_back(series);
+}
+
+static std::vector<Gauge *> burstGauges(const std::vector<BurstSeries> &series)
+{
+    std::vector<Gauge *> gauges;
+
+    for (const BurstSeries &s : series)
+    {
+        gauges.push_back(s.peak_gauge);
+        if (s.above_gauge != nullptr)
+            gauges.push_back(s.above_gauge);
+    }
+
+    return gauges;
+}
+
+// Rebinds the series of the current topology, using the last read as the first sample
+static void bindBurstSeries(BurstSampler &burst)
+{
+    const QueryResult &data = burst.hStat->u.query_v3.data;
+    const std::vector<Gauge *> before = burstGauges(burst.series);
+    const size_t stream_clock = burst.topology.ports_count;
+
+    burst.series.clear();
+
+    for (int p = 0; p < burst.topology.ports_count; p++)
+    {
+        const std::string port = std::to_string(p);
+
+        for (size_t d = 0; d < PORT_DIRECTIONS_COUNT; d++)
+        {
+            const size_t direction_offset = portOffset(p, d);
+            const auto &statistics = *reinterpret_cast<const struct NtPortStatistics_v2_s *>(
+                reinterpret_cast<const char *>(&data) + direction_offset);
+
+            if (!statistics.valid.RMON1)
+                continue;
+
+            for (size_t c = 0; c < BURST_PORT_COUNTERS_COUNT; c++)
+                addSeries(burst, BURST_PORT_COUNTERS[c], direction_offset + BURST_PORT_COUNTERS[c].offset, p,
+                          {{"port", port}, {"direction", PORT_DIRECTIONS[d].name}});
+        }
+    }
+
+    for (const int s : streamBlocks(burst.topology.stream_ids))
+    {
+        for (size_t c = 0; c < BURST_STREAM_COUNTERS_COUNT; c++)
+            addSeries(burst, BURST_STREAM_COUNTERS[c], streamOffset(s) + BURST_STREAM_COUNTERS[c].offset,
+                      stream_clock, {{"stream_id", streamLabel(s)}});
+    }
+
+    readClocks(burst, burst.clocks);
+    burst.previous_read = std::chrono::steady_clock::now();
+    removeStaleMetrics(*burst.gauge_family, before, burstGauges(burst.series));
+}
+
+bool openBurstSampler(BurstSampler &burst, Family<Gauge> &gauge_family, const double rate_threshold,
+                      const int window_ms)
+{
+    char errorBuffer[NT_ERRBUF_SIZE];
+    int status;
+
+    if ((status = NT_StatOpen(&burst.hStatStream, "PrometheusBurstStat")) != NT_SUCCESS)
+    {
+        NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+        fprintf(stderr, "NT_StatOpen() failed: %s\n", errorBuffer);
+        return false;
+    }
+    burst.hStat.reset(new NtStatistics_t());
+    burst.gauge_family = &gauge_family;
+    burst.rate_threshold = rate_threshold;
+    burst.window = std::chrono::milliseconds(window_ms);
+    burst.window_end = std::chrono::steady_clock::now() + burst.window;
+    burst.topology = Topology();
+    burst.topology_version = 0;
+
+    return true;
+}
+
+void closeBurstSampler(BurstSampler &burst)
+{
+    NT_StatClose(burst.hStatStream);
+}
+
+// Publishes the window that just ended and starts the next one
+static void closeWindow(BurstSampler &burst)
+{
+    for (BurstSeries &series : burst.series)
+    {
+        series.peak_gauge->Set(series.peak);
+        if (series.above_gauge != nullptr)
+            series.above_gauge->Set(series.above);
+
+        series.peak = 0;
+        series.above = 0;
+    }
+}
+
+void processBurstSampler(BurstSampler &burst, SharedTopology &shared)
+{
+    char errorBuffer[NT_ERRBUF_SIZE];
+    int status;
+
+    if ((status = readSample(burst)) != NT_SUCCESS)
+    {
+        NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+        fprintf(stderr, "NT_StatRead() burst sample failed: %s\n", errorBuffer);
+        return;
+    }
+
+    if (takeTopology(shared, burst.topology, burst.topology_version))
+    {
+        bindBurstSeries(burst);
+        return;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    const double interval = std::chrono::duration<double>(now - burst.previous_read).count();
+    burst.previous_read = now;
+    readClocks(burst, burst.current_clocks);
+
+    const std::vector<double> &clocks = burst.current_clocks;
+    const QueryResult &data = burst.hStat->u.query_v3.data;
+
+    for (BurstSeries &series : burst.series)
+    {
+        // An adapter without time stamps falls back to the host interval between reads
+        const double elapsed =
+            clocks[series.clock] == 0 ? interval : clocks[series.clock] - burst.clocks[series.clock];
+
+        // Same hardware sample as the previous read
+        if (elapsed == 0)
+            continue;
+
+        // Time stamp went backwards, the adapter clock was set
+        if (elapsed < 0)
+        {
+            series.previous = counterAt(&data, series.offset);
+            continue;
+        }
+
+        const uint64_t delta = counterDelta(counterAt(&data, series.offset), series.previous);
+        const double rate = delta / elapsed;
+
+        series.peak = std::max(series.peak, rate);
+        if ((series.threshold == BURST_RATE_THRESHOLD && rate > burst.rate_threshold) ||
+            (series.threshold == BURST_ANY_INCREASE && delta > 0))
+            series.above += elapsed;
+    }
+
+    burst.clocks.swap(burst.current_clocks);
+
+    if (now >= burst.window_end)
+    {
+        closeWindow(burst);
+        burst.window_end += burst.window * ((now - burst.window_end) / burst.window + 1);
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "discovery.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using namespace prometheus;
+
+// Accepted burst sampling periods
+const int BURST_MIN_PERIOD_MS = 10;
+const int BURST_MAX_PERIOD_MS = 100;
+
+// When a series accumulates time above threshold
+enum BurstThreshold
+{
+    BURST_NO_THRESHOLD,
+    BURST_RATE_THRESHOLD, // Rate above BurstSampler::rate_threshold
+    BURST_ANY_INCREASE,   // Any increase at all, for drop counters
+};
+
+struct BurstDescriptor
+{
+    size_t offset;    // Offset of the uint64_t counter inside NtPortStatistics_v2_s or a streamid[] block
+    const char *type; // Label name: "pkts_peak_rate" or "bytes_peak_rate"
+    const char *name; // Label value, also the "above_threshold_seconds" label value
+    BurstThreshold threshold;
+};
+
+// One counter sampled at high frequency, with its peak rate and time above threshold over the current window
+struct BurstSeries
+{
+    size_t offset; // Offset of the counter inside QueryResult
+    size_t clock;  // Index of the hardware time stamp the counter is sampled with, see BurstSampler::clocks
+    BurstThreshold threshold;
+    uint64_t previous;
+    double peak;
+    double above; // Seconds
+    Gauge *peak_gauge;
+    Gauge *above_gauge; // nullptr for BURST_NO_THRESHOLD
+};
+
+// High-frequency QUERY_V3 sampler on its own stat stream. Rates are taken between hardware time stamps,
+// reads returning a time stamp that didn't move carry no new sample and are skipped.
+// Peaks and times above threshold are exported once per window, then start over.
+struct BurstSampler
+{
+    NtStatStream_t hStatStream;
+    std::unique_ptr<NtStatistics_t> hStat;
+    Family<Gauge> *gauge_family;
+    double rate_threshold; // Bytes per second
+    std::chrono::steady_clock::duration window;
+    std::chrono::steady_clock::time_point window_end;
+    Topology topology;
+    unsigned long topology_version;
+    std::vector<BurstSeries> series;
+    std::vector<double> clocks;         // Seconds of the previous sample: aPorts[p].ts per port, then stream.ts
+    std::vector<double> current_clocks; // Same layout for the sample being taken, reused across samples
+    std::chrono::steady_clock::time_point previous_read; // Stands in for clocks without time stamps
+};
+
+extern const BurstDescriptor BURST_PORT_COUNTERS[];
+extern const size_t BURST_PORT_COUNTERS_COUNT;
+extern const BurstDescriptor BURST_STREAM_COUNTERS[];
+extern const size_t BURST_STREAM_COUNTERS_COUNT;
+
+bool openBurstSampler(BurstSampler &burst, Family<Gauge> &gauge_family, const double rate_threshold,
+                      const int window_ms);
+void closeBurstSampler(BurstSampler &burst);
+
+// Takes one sample, following the ports and stream IDs of shared
+void processBurstSampler(BurstSampler &burst, SharedTopology &shared);
@@ -0,0 +1,184 @@
+#include <prometheus/registry.h>
+#include <prometheus/counter.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "colors.h"
+#include "continuity.h"
+#include "metrics.h"
+#include "rates.h"
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace prometheus;
+
+static const int COLORS_COUNT = sizeof(NtStatGroupColor_s().aColor) / sizeof(struct NtColorStatistics_s);
+static const int MAX_ADAPTERS = sizeof(QueryResult().adapter.aAdapters) / sizeof(struct NtStatGroupAdapter_s);
+
+bool loadColorNames(const std::string &path, std::map<int, std::string> &names)
+{
+    std::ifstream file(path);
+    std::string line;
+    int line_number = 0;
+
+    if (!file)
+    {
+        fprintf(stderr, "Cannot open color names file %s\n", path.c_str());
+        return false;
+    }
+
+    while (std::getline(file, line))
+    {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream fields(line);
+        int color;
+        std::string name;
+
+        if (!(fields >> color))
+        {
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+
+            fprintf(stderr, "%s:%d: color ID expected\n", path.c_str(), line_number);
+            return false;
+        }
+
+        if (color < 0 || color >= COLORS_COUNT || !(fields >> name))
+        {
+            fprintf(stderr, "%s:%d: expected \"<color 0-%d> <name>\"\n", path.c_str(), line_number, COLORS_COUNT - 1);
+            return false;
+        }
+
+        names[color] = name;
+    }
+
+    return true;
+}
+
+ColorTable bindColorMetrics(const NtStatistics_t &hStat, const std::map<int, std::string> &names)
+{
+    ColorTable colors;
+    colors.names = names;
+    colors.slots.assign(MAX_ADAPTERS * COLORS_COUNT, ColorSlot{nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0,
+                                                               std::chrono::steady_clock::now()});
+
+    for (int a = 0; a < MAX_ADAPTERS; a++)
+    {
+        const size_t clock = addColorClock(colors.rates, hStat, a);
+
+        for (int c = 0; c < COLORS_COUNT; c++)
+        {
+            const size_t offset = offsetof(QueryResult, adapter.aAdapters) + a * sizeof(struct NtStatGroupAdapter_s) +
+                                  offsetof(struct NtStatGroupAdapter_s, color.aColor) +
+                                  c * sizeof(struct NtColorStatistics_s);
+
+            colors.slots[a * COLORS_COUNT + c].previous_pkts = hStat.u.query_v3.data.adapter.aAdapters[a].color.aColor[c].pkts;
+            addRate(colors.rates, hStat, offset + offsetof(struct NtColorStatistics_s, pkts), clock, nullptr, NO_WINDOW);
+            addRate(colors.rates, hStat, offset + offsetof(struct NtColorStatistics_s, octets), clock, nullptr, NO_WINDOW);
+        }
+    }
+
+    return colors;
+}
+
+static void addColorSeries(Family<Counter> &counter_family, Family<Gauge> &gauge_family, ColorTable &colors,
+                           Checkpoint &checkpoint, const int adapter, const int color, ColorSlot &slot)
+{
+    Labels labels = {{"adapter", std::to_string(adapter)}, {"color", std::to_string(color)}};
+    const auto name = colors.names.find(color);
+
+    if (name != colors.names.end())
+        labels["filter"] = name->second;
+
+    labels["pkts_count"] = "color";
+    slot.pkts = &addContinuousCounter(counter_family, checkpoint, labels, slot.pkts_state);
+    labels.erase("pkts_count");
+    labels["bytes_count"] = "color";
+    slot.octets = &addContinuousCounter(counter_family, checkpoint, labels, slot.octets_state);
+    labels.erase("bytes_count");
+    labels["pkts_rate"] = "color";
+    slot.pkts_rate = &gauge_family.Add(labels);
+    labels.erase("pkts_rate");
+    labels["bytes_rate"] = "color";
+    slot.octets_rate = &gauge_family.Add(labels);
+
+    const size_t rate = (adapter * COLORS_COUNT + color) * 2;
+    colors.rates.gauges[rate] = slot.pkts_rate;
+    colors.rates.gauges[rate + 1] = slot.octets_rate;
+}
+
+static void removeColorSeries(Family<Counter> &counter_family, Family<Gauge> &gauge_family, ColorTable &colors,
+                              const size_t index)
+{
+    ColorSlot &slot = colors.slots[index];
+
+    counter_family.Remove(slot.pkts);
+    counter_family.Remove(slot.octets);
+    gauge_family.Remove(slot.pkts_rate);
+    gauge_family.Remove(slot.octets_rate);
+    slot.pkts = nullptr;
+    slot.octets = nullptr;
+    slot.pkts_rate = nullptr;
+    slot.octets_rate = nullptr;
+    colors.rates.gauges[index * 2] = nullptr;
+    colors.rates.gauges[index * 2 + 1] = nullptr;
+}
+
+void processColorMetrics(const NtStatistics_t &hStat, Family<Counter> &counter_family, Family<Gauge> &gauge_family,
+                         ColorTable &colors, Checkpoint &checkpoint, const int adapters_count, const double interval)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    for (int a = 0; a < MAX_ADAPTERS; a++)
+    {
+        const struct NtStatGroupColor_s &group = hStat.u.query_v3.data.adapter.aAdapters[a].color;
+
+        // Adapter gone or without color statistics
+        if (a >= adapters_count || !group.supported)
+        {
+            for (int c = 0; c < COLORS_COUNT; c++)
+            {
+                if (colors.slots[a * COLORS_COUNT + c].pkts != nullptr)
+                    removeColorSeries(counter_family, gauge_family, colors, a * COLORS_COUNT + c);
+            }
+            continue;
+        }
+
+        for (int c = 0; c < COLORS_COUNT; c++)
+        {
+            ColorSlot &slot = colors.slots[a * COLORS_COUNT + c];
+            const struct NtColorStatistics_s &counters = group.aColor[c];
+            const bool active = counters.pkts != slot.previous_pkts;
+
+            slot.previous_pkts = counters.pkts;
+            if (active)
+                slot.last_active = now;
+
+            if (slot.pkts == nullptr)
+            {
+                if (!active)
+                    continue;
+
+                addColorSeries(counter_family, gauge_family, colors, checkpoint, a, c, slot);
+            }
+            else if (now - slot.last_active >= std::chrono::milliseconds(COLOR_IDLE_MS))
+            {
+                removeColorSeries(counter_family, gauge_family, colors, a * COLORS_COUNT + c);
+                continue;
+            }
+
+            advanceCounter(*slot.pkts, *slot.pkts_state, counters.pkts);
+            advanceCounter(*slot.octets, *slot.octets_state, counters.octets);
+        }
+    }
+
+    // After the series changes, so colors that just started carrying traffic get their rate right away
+    processRates(colors.rates, hStat, nullptr, interval);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/counter.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "continuity.h"
+#include "rates.h"
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace prometheus;
+
+// Time without traffic after which a color's series are removed. Counted in time rather than cycles: fast or
+// synchronized collection rereads the same counter set between ntservice refreshes, which says nothing of idleness.
+const int COLOR_IDLE_MS = 60000;
+
+// Color counters of one adapter color. Series exist only while the color carries traffic.
+struct ColorSlot
+{
+    Counter *pkts;
+    Counter *octets;
+    CounterState *pkts_state;
+    CounterState *octets_state;
+    Gauge *pkts_rate;
+    Gauge *octets_rate;
+    uint64_t previous_pkts;
+    std::chrono::steady_clock::time_point last_active; // Last read where pkts moved
+};
+
+struct ColorTable
+{
+    std::map<int, std::string> names; // NTPL color ID -> filter name
+    std::vector<ColorSlot> slots;     // slots[adapter * 64 + color], for every adapter slot of QUERY_V3
+    RateEngine rates;                 // Packets then octets of every slot, timed by the adapter color time stamp
+};
+
+// Reads "<color id> <filter name>" lines, '#' starts a comment. Returns false on a malformed file.
+bool loadColorNames(const std::string &path, std::map<int, std::string> &names);
+
+ColorTable bindColorMetrics(const NtStatistics_t &hStat, const std::map<int, std::string> &names);
+
+// Adds series of colors that started carrying traffic and removes the ones idle for COLOR_IDLE_MS
+// or belonging to adapters beyond adapters_count. interval, in seconds, is used when colors have no time stamp.
+// Counters continue from their state in checkpoint.
+void processColorMetrics(const NtStatistics_t &hStat, Family<Counter> &counter_family, Family<Gauge> &gauge_family,
+                         ColorTable &colors, Checkpoint &checkpoint, const int adapters_count, const double interval);
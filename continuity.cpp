@@ -0,0 +1,118 @@
+#include <prometheus/registry.h>
+#include <prometheus/counter.h>
+#include "continuity.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <unistd.h> // fsync()
+
+using namespace prometheus;
+
+// "name=value,name=value" in label order. Label values come from port numbers, stream IDs and
+// color file names, none of which contain spaces.
+static std::string seriesKey(const Labels &labels)
+{
+    std::string key;
+
+    for (const auto &label : labels)
+    {
+        if (!key.empty())
+            key += ',';
+        key += label.first + '=' + label.second;
+    }
+
+    return key;
+}
+
+bool loadCheckpoint(Checkpoint &checkpoint, const std::string &path)
+{
+    std::ifstream file(path);
+    std::string line;
+    int line_number = 0;
+
+    checkpoint.path = path;
+    checkpoint.next_save = std::chrono::steady_clock::now() + std::chrono::milliseconds(CHECKPOINT_PERIOD_MS);
+
+    if (!file)
+        return true;
+
+    while (std::getline(file, line))
+    {
+        line_number++;
+
+        std::istringstream fields(line);
+        std::string key;
+        CounterState state;
+
+        if (!(fields >> key >> state.total >> state.previous))
+        {
+            fprintf(stderr, "%s:%d: expected \"<series> <total> <previous>\"\n", path.c_str(), line_number);
+            return false;
+        }
+
+        checkpoint.states[key] = state;
+    }
+
+    return true;
+}
+
+bool saveCheckpoint(const Checkpoint &checkpoint)
+{
+    if (checkpoint.path.empty())
+        return true;
+
+    const std::string temporary = checkpoint.path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "w");
+
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Cannot write checkpoint %s: %s\n", temporary.c_str(), strerror(errno));
+        return false;
+    }
+
+    for (const auto &entry : checkpoint.states)
+        fprintf(file, "%s %" PRIu64 " %" PRIu64 "\n", entry.first.c_str(), entry.second.total, entry.second.previous);
+
+    // The data must be on disk before the rename makes it the checkpoint
+    const bool written = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0 || !written || rename(temporary.c_str(), checkpoint.path.c_str()) != 0)
+    {
+        fprintf(stderr, "Cannot write checkpoint %s: %s\n", checkpoint.path.c_str(), strerror(errno));
+        remove(temporary.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void saveDueCheckpoint(Checkpoint &checkpoint)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    if (now < checkpoint.next_save)
+        return;
+
+    saveCheckpoint(checkpoint);
+    checkpoint.next_save = now + std::chrono::milliseconds(CHECKPOINT_PERIOD_MS);
+}
+
+Counter &addContinuousCounter(Family<Counter> &family, Checkpoint &checkpoint, const Labels &labels,
+                              CounterState *&state)
+{
+    Counter &counter = family.Add(labels);
+
+    // A series re-added after removal restarts from zero in the family
+    state = &checkpoint.states.insert({seriesKey(labels), CounterState{0, 0}}).first->second;
+    if (counter.Value() < state->total)
+        counter.Increment(state->total - counter.Value());
+
+    return counter;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/counter.h>
+#include "metrics.h"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+
+using namespace prometheus;
+
+// Period of the checkpoint writes, on top of the one at shutdown
+const int CHECKPOINT_PERIOD_MS = 10000;
+
+// Exported value of a counter series and the hardware value it was last advanced to
+struct CounterState
+{
+    uint64_t total;
+    uint64_t previous;
+};
+
+// Counter states by series, persisted so exported counters keep increasing across exporter and ntservice restarts.
+// States of series that went away are kept, a stream ID or color coming back continues where it stopped.
+struct Checkpoint
+{
+    std::string path;                           // Empty when not persisted
+    std::map<std::string, CounterState> states; // Series key, built from its labels -> state
+    std::chrono::steady_clock::time_point next_save;
+};
+
+// Reads "<series key> <total> <previous>" lines of a previous run. A missing file starts from scratch.
+// Returns false on a malformed file.
+bool loadCheckpoint(Checkpoint &checkpoint, const std::string &path);
+
+// Writes the states to a temporary file renamed over the checkpoint, so a crash leaves the previous one intact
+bool saveCheckpoint(const Checkpoint &checkpoint);
+
+// Saves the checkpoint once CHECKPOINT_PERIOD_MS has passed since the previous save
+void saveDueCheckpoint(Checkpoint &checkpoint);
+
+// Adds the series with labels, brought up to its total in checkpoint, and returns its state.
+// A series seen for the first time counts from zero, so its first advance exports the whole hardware value.
+Counter &addContinuousCounter(Family<Counter> &family, Checkpoint &checkpoint, const Labels &labels,
+                              CounterState *&state);
+
+// A hardware value going backwards means the counters were cleared or ntservice restarted, counting resumes from it
+inline void advanceCounter(Counter &counter, CounterState &state, const uint64_t current)
+{
+    const uint64_t delta = counterDelta(current, state.previous);
+
+    state.total += delta;
+    counter.Increment(delta);
+}
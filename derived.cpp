@@ -0,0 +1,171 @@
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "derived.h"
+#include "metrics.h"
+#include "rates.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace prometheus;
+
+#define PORT_REF(group, field) \
+    { offsetof(struct NtPortStatistics_v2_s, group.field), offsetof(struct NtPortStatistics_v2_s, valid.group) }
+
+#define NO_REF { NO_COUNTER, ALWAYS_VALID }
+
+const RatioDescriptor PORT_RATIOS[] = {
+    // Duplicates found by the adapter, dropped or only marked, out of all received packets
+    {"dedup", {PORT_REF(extDrop, pktsDedup), PORT_REF(decode, pktsDuplicate)}, {PORT_REF(RMON1, pkts), NO_REF}},
+
+    // IP fragment table hits out of all lookups, per fragment position
+    {"ipf_first_hit", {PORT_REF(ipf, ipFragTableFirstHit), NO_REF},
+                      {PORT_REF(ipf, ipFragTableFirstHit), PORT_REF(ipf, ipFragTableFirstNoHit)}},
+    {"ipf_mid_hit", {PORT_REF(ipf, ipFragTableMidHit), NO_REF},
+                    {PORT_REF(ipf, ipFragTableMidHit), PORT_REF(ipf, ipFragTableMidNoHit)}},
+    {"ipf_last_hit", {PORT_REF(ipf, ipFragTableLastHit), NO_REF},
+                     {PORT_REF(ipf, ipFragTableLastHit), PORT_REF(ipf, ipFragTableLastNoHit)}},
+};
+const size_t PORT_RATIOS_COUNT = sizeof(PORT_RATIOS) / sizeof(PORT_RATIOS[0]);
+
+static inline uint64_t counterSum(const void *base, const size_t (&offsets)[2])
+{
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        if (offsets[i] != NO_COUNTER)
+            sum += counterAt(base, offsets[i]);
+    }
+
+    return sum;
+}
+
+static bool refsValid(const void *statistics, const CounterRef (&refs)[2])
+{
+    for (size_t i = 0; i < 2; i++)
+    {
+        if (refs[i].offset != NO_COUNTER && !counterValid(statistics, refs[i].valid_offset))
+            return false;
+    }
+
+    return true;
+}
+
+static void bindRefs(const CounterRef (&refs)[2], const size_t base_offset, size_t (&offsets)[2])
+{
+    for (size_t i = 0; i < 2; i++)
+        offsets[i] = refs[i].offset != NO_COUNTER ? base_offset + refs[i].offset : NO_COUNTER;
+}
+
+DerivedTable bindPortDerivedMetrics(const NtStatistics_t &hStat, Family<Gauge> &gauge_family, WindowAggregator &windows,
+                                    const int ports_count)
+{
+    const auto *data = &hStat.u.query_v3.data;
+    DerivedTable derived;
+
+    for (int p = 0; p < ports_count; p++)
+    {
+        const std::string port = std::to_string(p);
+        const size_t clock = addPortClock(derived.rates, hStat, p);
+
+        for (size_t d = 0; d < PORT_DIRECTIONS_COUNT; d++)
+        {
+            const size_t direction_offset = portOffset(p, d);
+            const char *statistics = reinterpret_cast<const char *>(data) + direction_offset;
+
+            for (size_t c = 0; c < PORT_COUNTERS_COUNT; c++)
+            {
+                if (!counterValid(statistics, PORT_COUNTERS[c].valid_offset))
+                    continue;
+
+                const Labels labels = {{rateType(PORT_COUNTERS[c].type), PORT_COUNTERS[c].name},
+                                       {"port", port},
+                                       {"direction", PORT_DIRECTIONS[d].name}};
+                Gauge &gauge = gauge_family.Add(labels);
+                addRate(derived.rates, hStat, direction_offset + PORT_COUNTERS[c].offset, clock, &gauge,
+                        addWindowSeries(windows, &gauge, labels));
+            }
+
+            for (size_t r = 0; r < PORT_RATIOS_COUNT; r++)
+            {
+                const RatioDescriptor &descriptor = PORT_RATIOS[r];
+
+                if (!refsValid(statistics, descriptor.numerator) || !refsValid(statistics, descriptor.denominator))
+                    continue;
+
+                BoundRatio ratio;
+                bindRefs(descriptor.numerator, direction_offset, ratio.numerator);
+                bindRefs(descriptor.denominator, direction_offset, ratio.denominator);
+                ratio.previous_numerator = counterSum(data, ratio.numerator);
+                ratio.previous_denominator = counterSum(data, ratio.denominator);
+                const Labels labels = {{"ratio", descriptor.name},
+                                       {"port", port},
+                                       {"direction", PORT_DIRECTIONS[d].name}};
+                ratio.gauge = &gauge_family.Add(labels);
+                ratio.window = addWindowSeries(windows, ratio.gauge, labels);
+                derived.ratios.push_back(ratio);
+            }
+        }
+    }
+
+    return derived;
+}
+
+DerivedTable bindStreamDerivedMetrics(const NtStatistics_t &hStat, Family<Gauge> &gauge_family, WindowAggregator &windows,
+                                      const std::vector<int> &stream_ids)
+{
+    DerivedTable derived;
+    const size_t clock = addStreamClock(derived.rates, hStat);
+
+    for (const int s : streamBlocks(stream_ids)) {
+        const std::string stream_id = streamLabel(s);
+
+        for (size_t c = 0; c < STREAM_COUNTERS_COUNT; c++) {
+            const Labels labels = {{rateType(STREAM_COUNTERS[c].type), STREAM_COUNTERS[c].name}, {"stream_id", stream_id}};
+            Gauge &gauge = gauge_family.Add(labels);
+            addRate(derived.rates, hStat, streamOffset(s) + STREAM_COUNTERS[c].offset, clock, &gauge,
+                    addWindowSeries(windows, &gauge, labels));
+        }
+    }
+
+    return derived;
+}
+
+std::vector<Gauge *> tableGauges(const DerivedTable &table)
+{
+    std::vector<Gauge *> gauges;
+
+    gauges.insert(gauges.end(), table.rates.gauges.begin(), table.rates.gauges.end());
+    for (const BoundRatio &ratio : table.ratios)
+        gauges.push_back(ratio.gauge);
+
+    return gauges;
+}
+
+void processDerivedMetrics(const NtStatistics_t &hStat, DerivedTable &derived, WindowAggregator &windows,
+                           const double interval)
+{
+    const auto *data = &hStat.u.query_v3.data;
+
+    processRates(derived.rates, hStat, &windows, interval);
+
+    if (interval <= 0)
+        return;
+
+    for (BoundRatio &ratio : derived.ratios)
+    {
+        const uint64_t numerator = counterDelta(counterSum(data, ratio.numerator), ratio.previous_numerator);
+        const uint64_t denominator = counterDelta(counterSum(data, ratio.denominator), ratio.previous_denominator);
+
+        if (denominator == 0)
+            continue;
+
+        const double value = static_cast<double>(numerator) / denominator;
+        ratio.gauge->Set(value);
+        observeWindow(windows, ratio.window, value);
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "metrics.h"
+#include "rates.h"
+#include "window.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace prometheus;
+
+// A counter referenced by a derived metric
+struct CounterRef
+{
+    size_t offset;
+    size_t valid_offset;
+};
+
+// Ratio of the increase of the numerator counters to the increase of the denominator counters
+// over one collection interval. Unused slots hold NO_COUNTER.
+// An interval where the denominator didn't increase keeps the previous value: no IP fragment lookups is not a 0% hit ratio.
+struct RatioDescriptor
+{
+    const char *name;
+    CounterRef numerator[2];
+    CounterRef denominator[2];
+};
+
+// Interval ratio, resolved at startup
+struct BoundRatio
+{
+    size_t numerator[2];
+    size_t denominator[2];
+    uint64_t previous_numerator;
+    uint64_t previous_denominator;
+    Gauge *gauge;
+    size_t window; // WindowAggregator slot
+};
+
+struct DerivedTable
+{
+    RateEngine rates;
+    std::vector<BoundRatio> ratios;
+};
+
+extern const RatioDescriptor PORT_RATIOS[];
+extern const size_t PORT_RATIOS_COUNT;
+
+// Binds a rate to every supported port or stream counter and the port ratios, using hStat as the first sample.
+// Rates are taken between hardware time stamps. Every rate and ratio also gets window companions in windows.
+DerivedTable bindPortDerivedMetrics(const NtStatistics_t &hStat, Family<Gauge> &gauge_family, WindowAggregator &windows,
+                                    const int ports_count);
+DerivedTable bindStreamDerivedMetrics(const NtStatistics_t &hStat, Family<Gauge> &gauge_family, WindowAggregator &windows,
+                                      const std::vector<int> &stream_ids);
+
+std::vector<Gauge *> tableGauges(const DerivedTable &table);
+
+// Updates every derived metric from the counter increase since the previous call, interval is in seconds
+void processDerivedMetrics(const NtStatistics_t &hStat, DerivedTable &derived, WindowAggregator &windows,
+                           const double interval);
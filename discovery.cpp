@@ -0,0 +1,89 @@
+#include <napatech/nt.h>
+#include "discovery.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+bool discoverTopology(NtInfoStream_t hInfoStream, Topology &topology)
+{
+    NtInfo_t hInfo;
+    char errorBuffer[NT_ERRBUF_SIZE];
+    int status;
+
+    hInfo.cmd = NT_INFO_CMD_READ_SYSTEM;
+    if ((status = NT_InfoRead(hInfoStream, &hInfo)) != NT_SUCCESS)
+    {
+        NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+        fprintf(stderr, "NT_InfoRead() failed: %s\n", errorBuffer);
+        return false;
+    }
+
+    // Never go beyond what the statistics structures actually hold
+    const int max_ports = sizeof(QueryResult().port.aPorts) / sizeof(QueryResult().port.aPorts[0]);
+    const int max_adapters = sizeof(QueryResult().adapter.aAdapters) / sizeof(QueryResult().adapter.aAdapters[0]);
+
+    topology.ports_count = std::min<int>(hInfo.u.system.data.numPorts, max_ports);
+    topology.adapters_count = std::min<int>(hInfo.u.system.data.numAdapters, max_adapters);
+
+    // A port whose info can't be read only loses its adapter label, discovery goes on
+    topology.port_adapters.clear();
+    for (int p = 0; p < topology.ports_count; p++)
+    {
+        hInfo.cmd = NT_INFO_CMD_READ_PORT_V9;
+        hInfo.u.port_v9.portNo = static_cast<uint8_t>(p);
+        if ((status = NT_InfoRead(hInfoStream, &hInfo)) != NT_SUCCESS)
+        {
+            NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+            fprintf(stderr, "NT_InfoRead() port %d failed: %s\n", p, errorBuffer);
+            topology.port_adapters.push_back(-1);
+            continue;
+        }
+        topology.port_adapters.push_back(hInfo.u.port_v9.data.adapterNo);
+    }
+
+    hInfo.cmd = NT_INFO_CMD_READ_STREAM;
+    if ((status = NT_InfoRead(hInfoStream, &hInfo)) != NT_SUCCESS)
+    {
+        NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+        fprintf(stderr, "NT_InfoRead() failed: %s\n", errorBuffer);
+        return false;
+    }
+
+    const struct NtInfoStreams_s &streams = hInfo.u.stream.data;
+    const int max_streams = sizeof(QueryResult().stream.streamid) / sizeof(QueryResult().stream.streamid[0]);
+
+    topology.stream_ids.clear();
+    for (uint32_t i = 0; i < streams.count && i < static_cast<uint32_t>(max_streams); i++)
+    {
+        if (streams.streamIDList[i] >= 0 && streams.streamIDList[i] < max_streams)
+            topology.stream_ids.push_back(streams.streamIDList[i]);
+    }
+    std::sort(topology.stream_ids.begin(), topology.stream_ids.end());
+
+    return true;
+}
+
+void publishTopology(SharedTopology &shared, const Topology &topology)
+{
+    std::lock_guard<std::mutex> guard(shared.lock);
+
+    if (topology == shared.topology)
+        return;
+
+    shared.topology = topology;
+    shared.version++;
+}
+
+bool takeTopology(SharedTopology &shared, Topology &topology, unsigned long &version)
+{
+    std::lock_guard<std::mutex> guard(shared.lock);
+
+    if (shared.version == version)
+        return false;
+
+    topology = shared.topology;
+    version = shared.version;
+    return true;
+}
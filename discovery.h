@@ -0,0 +1,38 @@
+#pragma once
+
+#include <napatech/nt.h>
+
+#include <mutex>
+#include <vector>
+
+// Ports, adapters and stream IDs currently present in the system
+struct Topology
+{
+    int ports_count;
+    int adapters_count;
+    std::vector<int> port_adapters; // Adapter of each port, -1 when its port info can't be read
+    std::vector<int> stream_ids;    // Sorted IDs of the created streams
+
+    bool operator==(const Topology &other) const
+    {
+        return ports_count == other.ports_count && adapters_count == other.adapters_count &&
+               port_adapters == other.port_adapters && stream_ids == other.stream_ids;
+    }
+};
+
+// Topology published by the discovery tier to the collection tiers
+struct SharedTopology
+{
+    std::mutex lock;
+    Topology topology;
+    unsigned long version; // Bumped on every change
+};
+
+// Combines NT_INFO_CMD_READ_SYSTEM, NT_INFO_CMD_READ_PORT_V9 and NT_INFO_CMD_READ_STREAM,
+// bounded by what QUERY_V3 can hold
+bool discoverTopology(NtInfoStream_t hInfoStream, Topology &topology);
+
+void publishTopology(SharedTopology &shared, const Topology &topology);
+
+// Copies the shared topology when it changed since version, returns false otherwise
+bool takeTopology(SharedTopology &shared, Topology &topology, unsigned long &version);
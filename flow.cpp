@@ -0,0 +1,216 @@
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "flow.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace prometheus;
+
+#define FLOW_COUNTER(field, name) \
+    { offsetof(struct NtStatisticsFlowData_v1_s, field), offsetof(struct NtStatisticsFlowData_v0_s, field), name }
+
+const FlowCounterDescriptor FLOW_COUNTERS[] = {
+    FLOW_COUNTER(learnDone, "learn_done"),
+    FLOW_COUNTER(learnFail, "learn_fail"),
+    FLOW_COUNTER(learnIgnore, "learn_ignore"),
+    FLOW_COUNTER(unlearnDone, "unlearn_done"),
+    FLOW_COUNTER(unlearnIgnore, "unlearn_ignore"),
+    FLOW_COUNTER(automaticUnlearnDone, "automatic_unlearn_done"),
+    FLOW_COUNTER(automaticUnlearnIgnore, "automatic_unlearn_ignore"),
+    FLOW_COUNTER(automaticUnlearnFail, "automatic_unlearn_fail"),
+    FLOW_COUNTER(timeoutUnlearnDone, "timeout_unlearn_done"),
+    FLOW_COUNTER(dmaWriteRecords, "dma_write_records"),
+    FLOW_COUNTER(dmaReadInfoRecords, "dma_read_info_records"),
+    FLOW_COUNTER(dmaReadStatRecords, "dma_read_stat_records"),
+    FLOW_COUNTER(dmaDroppedInfoRecords, "dma_dropped_info_records"),
+    FLOW_COUNTER(dmaDroppedStatRecords, "dma_dropped_stat_records"),
+};
+const size_t FLOW_COUNTERS_COUNT = sizeof(FLOW_COUNTERS) / sizeof(FLOW_COUNTERS[0]);
+
+static int readFlowStatistics(FlowCollector &flow, const uint8_t adapter, const enum NtStatisticsCmd_e cmd)
+{
+    flow.hStat->cmd = cmd;
+
+    if (cmd == NT_STATISTICS_READ_CMD_FLOW_V1)
+    {
+        flow.hStat->u.flowData_v1.clear = 0;
+        flow.hStat->u.flowData_v1.adapterNo = adapter;
+    }
+    else
+    {
+        flow.hStat->u.flowData_v0.clear = 0;
+        flow.hStat->u.flowData_v0.adapterNo = adapter;
+    }
+
+    return NT_StatRead(flow.hStatStream, flow.hStat.get());
+}
+
+static const void *flowData(const FlowCollector &flow, const FlowAdapter &adapter)
+{
+    if (adapter.cmd == NT_STATISTICS_READ_CMD_FLOW_V1)
+        return &flow.hStat->u.flowData_v1;
+
+    return &flow.hStat->u.flowData_v0;
+}
+
+static uint64_t flowCounter(const FlowAdapter &adapter, const void *data, const size_t c)
+{
+    const size_t offset = adapter.cmd == NT_STATISTICS_READ_CMD_FLOW_V1 ? FLOW_COUNTERS[c].offset_v1
+                                                                         : FLOW_COUNTERS[c].offset_v0;
+    return counterAt(data, offset);
+}
+
+// Binds the series of an adapter with a flow matcher, false when it has none
+static bool probeFlowAdapter(FlowCollector &flow, Family<Gauge> &gauge_family, const int a, FlowAdapter &adapter)
+{
+    char errorBuffer[NT_ERRBUF_SIZE];
+    int status;
+
+    adapter.adapter = static_cast<uint8_t>(a);
+    adapter.cmd = NT_STATISTICS_READ_CMD_FLOW_V1;
+
+    if (readFlowStatistics(flow, adapter.adapter, adapter.cmd) != NT_SUCCESS)
+    {
+        adapter.cmd = NT_STATISTICS_READ_CMD_FLOW_V0;
+
+        if ((status = readFlowStatistics(flow, adapter.adapter, adapter.cmd)) != NT_SUCCESS)
+        {
+            NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+            printf("Adapter %d doesn't provide flow statistics: %s\n", a, errorBuffer);
+            return false;
+        }
+    }
+    adapter.previous_read = std::chrono::steady_clock::now();
+
+    const std::string adapter_no = std::to_string(a);
+    const void *data = flowData(flow, adapter);
+
+    for (size_t c = 0; c < FLOW_COUNTERS_COUNT; c++)
+    {
+        adapter.counters.push_back(&gauge_family.Add({{"flow_count", FLOW_COUNTERS[c].name}, {"adapter", adapter_no}}));
+        adapter.rates.push_back(&gauge_family.Add({{"flow_rate", FLOW_COUNTERS[c].name}, {"adapter", adapter_no}}));
+        adapter.previous.push_back(flowCounter(adapter, data, c));
+    }
+
+    adapter.flows = nullptr;
+    adapter.flows_rate = nullptr;
+    if (adapter.cmd == NT_STATISTICS_READ_CMD_FLOW_V1)
+    {
+        adapter.flows = &gauge_family.Add({{"flow_count", "current"}, {"adapter", adapter_no}});
+        adapter.flows_rate = &gauge_family.Add({{"flow_rate", "current"}, {"adapter", adapter_no}});
+        adapter.previous_flows = flow.hStat->u.flowData_v1.currentFlowCount;
+    }
+
+    return true;
+}
+
+static std::vector<Gauge *> flowGauges(const std::vector<FlowAdapter> &adapters)
+{
+    std::vector<Gauge *> gauges;
+
+    for (const FlowAdapter &adapter : adapters)
+    {
+        gauges.insert(gauges.end(), adapter.counters.begin(), adapter.counters.end());
+        gauges.insert(gauges.end(), adapter.rates.begin(), adapter.rates.end());
+        if (adapter.flows != nullptr)
+        {
+            gauges.push_back(adapter.flows);
+            gauges.push_back(adapter.flows_rate);
+        }
+    }
+
+    return gauges;
+}
+
+bool openFlowCollector(FlowCollector &flow, Family<Gauge> &gauge_family, const int adapters_count)
+{
+    char errorBuffer[NT_ERRBUF_SIZE];
+    int status;
+
+    if ((status = NT_StatOpen(&flow.hStatStream, "PrometheusFlowStat")) != NT_SUCCESS)
+    {
+        NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+        fprintf(stderr, "NT_StatOpen() failed: %s\n", errorBuffer);
+        return false;
+    }
+    flow.hStat.reset(new NtStatistics_t());
+
+    bindFlowAdapters(flow, gauge_family, adapters_count);
+    return true;
+}
+
+void bindFlowAdapters(FlowCollector &flow, Family<Gauge> &gauge_family, const int adapters_count)
+{
+    std::vector<FlowAdapter> adapters;
+
+    for (int a = 0; a < adapters_count; a++)
+    {
+        const auto bound = std::find_if(flow.adapters.begin(), flow.adapters.end(),
+                                        [a](const FlowAdapter &adapter) { return adapter.adapter == a; });
+        if (bound != flow.adapters.end())
+        {
+            adapters.push_back(*bound);
+            continue;
+        }
+
+        FlowAdapter adapter;
+        if (probeFlowAdapter(flow, gauge_family, a, adapter))
+            adapters.push_back(adapter);
+    }
+
+    removeStaleMetrics(gauge_family, flowGauges(flow.adapters), flowGauges(adapters));
+    flow.adapters.swap(adapters);
+}
+
+void closeFlowCollector(FlowCollector &flow)
+{
+    NT_StatClose(flow.hStatStream);
+}
+
+void processFlowMetrics(FlowCollector &flow)
+{
+    char errorBuffer[NT_ERRBUF_SIZE];
+    int status;
+
+    for (FlowAdapter &adapter : flow.adapters)
+    {
+        // A failed read leaves previous and previous_read alone, the next rate spans both intervals
+        if ((status = readFlowStatistics(flow, adapter.adapter, adapter.cmd)) != NT_SUCCESS)
+        {
+            NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+            fprintf(stderr, "NT_StatRead() flow statistics of adapter %d failed: %s\n", adapter.adapter, errorBuffer);
+            continue;
+        }
+
+        const auto current_read = std::chrono::steady_clock::now();
+        const double interval = std::chrono::duration<double>(current_read - adapter.previous_read).count();
+        adapter.previous_read = current_read;
+
+        const void *data = flowData(flow, adapter);
+
+        for (size_t c = 0; c < FLOW_COUNTERS_COUNT; c++)
+        {
+            const uint64_t current = flowCounter(adapter, data, c);
+
+            adapter.counters[c]->Set(current);
+            if (interval > 0)
+                adapter.rates[c]->Set(counterDelta(current, adapter.previous[c]) / interval);
+        }
+
+        if (adapter.flows != nullptr)
+        {
+            const uint64_t flows = flow.hStat->u.flowData_v1.currentFlowCount;
+
+            adapter.flows->Set(flows);
+            if (interval > 0)
+                adapter.flows_rate->Set((static_cast<double>(flows) - adapter.previous_flows) / interval);
+            adapter.previous_flows = flows;
+        }
+    }
+}
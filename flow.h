@@ -0,0 +1,56 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using namespace prometheus;
+
+// Flow matcher counter, present in both NtStatisticsFlowData_v1_s and NtStatisticsFlowData_v0_s
+struct FlowCounterDescriptor
+{
+    size_t offset_v1;
+    size_t offset_v0;
+    const char *name;
+};
+
+// Flow statistics of one adapter. Adapters without a flow matcher are not kept.
+struct FlowAdapter
+{
+    uint8_t adapter;
+    enum NtStatisticsCmd_e cmd;     // NT_STATISTICS_READ_CMD_FLOW_V1, or FLOW_V0 where V1 isn't supported
+    std::vector<Gauge *> counters;  // One per FLOW_COUNTERS entry
+    std::vector<Gauge *> rates;     // One per FLOW_COUNTERS entry
+    std::vector<uint64_t> previous; // One per FLOW_COUNTERS entry
+    Gauge *flows;                   // currentFlowCount, FLOW_V1 only
+    Gauge *flows_rate;              // Signed change of currentFlowCount per second, FLOW_V1 only
+    uint64_t previous_flows;
+    std::chrono::steady_clock::time_point previous_read; // Last successful read, rates span from there
+};
+
+struct FlowCollector
+{
+    NtStatStream_t hStatStream;
+    std::unique_ptr<NtStatistics_t> hStat;
+    std::vector<FlowAdapter> adapters;
+};
+
+extern const FlowCounterDescriptor FLOW_COUNTERS[];
+extern const size_t FLOW_COUNTERS_COUNT;
+
+// Probes FLOW_V1 then FLOW_V0 on every adapter and binds the series of the ones with a flow matcher
+bool openFlowCollector(FlowCollector &flow, Family<Gauge> &gauge_family, const int adapters_count);
+void closeFlowCollector(FlowCollector &flow);
+
+// Keeps the adapters already bound below adapters_count, probes the others and removes the series of adapters gone.
+// Label building and Family::Add() happen here, at startup and when the topology changes only.
+void bindFlowAdapters(FlowCollector &flow, Family<Gauge> &gauge_family, const int adapters_count);
+
+// Reads the flow statistics of every adapter without clearing them
+void processFlowMetrics(FlowCollector &flow);
@@ -0,0 +1,208 @@
+#include <prometheus/registry.h>
+#include <prometheus/counter.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "link.h"
+#include "metrics.h"
+#include "rates.h"
+#include "window.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace prometheus;
+
+static double linkSpeed(const enum NtLinkSpeed_e speed)
+{
+    switch (speed)
+    {
+    case NT_LINK_SPEED_10M:
+        return 10e6;
+    case NT_LINK_SPEED_100M:
+        return 100e6;
+    case NT_LINK_SPEED_1G:
+        return 1e9;
+    case NT_LINK_SPEED_10G:
+        return 10e9;
+    case NT_LINK_SPEED_25G:
+        return 25e9;
+    case NT_LINK_SPEED_40G:
+        return 40e9;
+    case NT_LINK_SPEED_50G:
+        return 50e9;
+    case NT_LINK_SPEED_100G:
+        return 100e9;
+    default:
+        return 0;
+    }
+}
+
+// Link speed of a port, 0 while it is down or can't be read
+static double readPortSpeed(NtInfoStream_t hInfoStream, const int port)
+{
+    NtInfo_t hInfo;
+    char errorBuffer[NT_ERRBUF_SIZE];
+    int status;
+
+    hInfo.cmd = NT_INFO_CMD_READ_PORT_V9;
+    hInfo.u.port_v9.portNo = static_cast<uint8_t>(port);
+    if ((status = NT_InfoRead(hInfoStream, &hInfo)) != NT_SUCCESS)
+    {
+        NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+        fprintf(stderr, "NT_InfoRead() port %d failed: %s\n", port, errorBuffer);
+        return 0;
+    }
+
+    return hInfo.u.port_v9.data.state == NT_LINK_STATE_UP ? linkSpeed(hInfo.u.port_v9.data.speed) : 0;
+}
+
+static void refreshAllPorts(LinkWatcher &links, PortLinks &port_links, const int ports_count)
+{
+    std::vector<double> speeds;
+
+    for (int p = 0; p < ports_count; p++)
+        speeds.push_back(readPortSpeed(links.hInfoStream, p));
+
+    std::lock_guard<std::mutex> guard(port_links.lock);
+    port_links.speeds = speeds;
+    links.ports_count = ports_count;
+}
+
+bool openLinkWatcher(LinkWatcher &links, Family<Counter> &counter_family, PortLinks &port_links, const int ports_count)
+{
+    char errorBuffer[NT_ERRBUF_SIZE];
+    int status;
+
+    if ((status = NT_EventOpen(&links.hEventStream, "PrometheusLinkEvents", NT_EVENT_SOURCE_PORT)) != NT_SUCCESS)
+    {
+        NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+        fprintf(stderr, "NT_EventOpen() failed: %s\n", errorBuffer);
+        return false;
+    }
+    if ((status = NT_InfoOpen(&links.hInfoStream, "PrometheusLinkInfo")) != NT_SUCCESS)
+    {
+        NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+        fprintf(stderr, "NT_InfoOpen() failed: %s\n", errorBuffer);
+        NT_EventClose(links.hEventStream);
+        return false;
+    }
+    links.events = &counter_family.Add({{"link", "events"}});
+    refreshAllPorts(links, port_links, ports_count);
+
+    return true;
+}
+
+void closeLinkWatcher(LinkWatcher &links)
+{
+    NT_InfoClose(links.hInfoStream);
+    NT_EventClose(links.hEventStream);
+}
+
+void processLinkEvents(LinkWatcher &links, PortLinks &port_links, const int ports_count)
+{
+    NtEvent_t event;
+    char errorBuffer[NT_ERRBUF_SIZE];
+    int status;
+
+    if (ports_count != links.ports_count)
+        refreshAllPorts(links, port_links, ports_count);
+
+    while ((status = NT_EventRead(links.hEventStream, &event, 0)) == NT_SUCCESS)
+    {
+        if (event.type != NT_EVENT_SOURCE_PORT)
+            continue;
+
+        const int port = event.u.portEvent.portNo;
+        links.events->Increment();
+        if (port >= ports_count)
+            continue;
+
+        const double speed = readPortSpeed(links.hInfoStream, port);
+        std::lock_guard<std::mutex> guard(port_links.lock);
+        port_links.speeds[port] = speed;
+    }
+
+    if (status != NT_STATUS_TIMEOUT && status != NT_STATUS_TRYAGAIN)
+    {
+        NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+        fprintf(stderr, "NT_EventRead() failed: %s\n", errorBuffer);
+    }
+}
+
+UtilizationTable bindUtilizationMetrics(const NtStatistics_t &hStat, Family<Gauge> &gauge_family, const int ports_count)
+{
+    const auto *data = &hStat.u.query_v3.data;
+    UtilizationTable utilization;
+
+    for (int p = 0; p < ports_count; p++)
+    {
+        const std::string port = std::to_string(p);
+        const size_t clock = addPortClock(utilization.rates, hStat, p);
+
+        utilization.speeds.push_back(&gauge_family.Add({{"link", "speed_bps"}, {"port", port}}));
+
+        for (size_t d = 0; d < PORT_DIRECTIONS_COUNT; d++)
+        {
+            const size_t direction_offset = portOffset(p, d);
+            const auto &statistics = *reinterpret_cast<const struct NtPortStatistics_v2_s *>(
+                reinterpret_cast<const char *>(data) + direction_offset);
+
+            if (!statistics.valid.RMON1)
+                continue;
+
+            addRate(utilization.rates, hStat, direction_offset + offsetof(struct NtPortStatistics_v2_s, RMON1.octets),
+                    clock, nullptr, NO_WINDOW);
+            addRate(utilization.rates, hStat, direction_offset + offsetof(struct NtPortStatistics_v2_s, RMON1.pkts),
+                    clock, nullptr, NO_WINDOW);
+            utilization.ports.push_back(p);
+            utilization.held.push_back(0);
+            utilization.utilization.push_back(&gauge_family.Add(
+                {{"link", "utilization_percent"}, {"port", port}, {"direction", PORT_DIRECTIONS[d].name}}));
+            utilization.headroom.push_back(&gauge_family.Add(
+                {{"link", "headroom_bps"}, {"port", port}, {"direction", PORT_DIRECTIONS[d].name}}));
+        }
+    }
+
+    return utilization;
+}
+
+std::vector<Gauge *> tableGauges(const UtilizationTable &table)
+{
+    std::vector<Gauge *> gauges = table.speeds;
+
+    gauges.insert(gauges.end(), table.utilization.begin(), table.utilization.end());
+    gauges.insert(gauges.end(), table.headroom.begin(), table.headroom.end());
+
+    return gauges;
+}
+
+void processUtilizationMetrics(const NtStatistics_t &hStat, UtilizationTable &utilization, PortLinks &port_links,
+                               const double interval)
+{
+    processRates(utilization.rates, hStat, nullptr, interval);
+
+    std::lock_guard<std::mutex> guard(port_links.lock);
+    const std::vector<double> &speeds = port_links.speeds;
+
+    for (size_t p = 0; p < utilization.speeds.size(); p++)
+        utilization.speeds[p]->Set(p < speeds.size() ? speeds[p] : 0);
+
+    for (size_t i = 0; i < utilization.ports.size(); i++)
+    {
+        const size_t octets = 2 * i;
+        const size_t pkts = octets + 1;
+        const size_t port = utilization.ports[i];
+        const double speed = port < speeds.size() ? speeds[port] : 0;
+
+        // Both rates come from the same port clock
+        if (utilization.rates.inverse[octets] != 0)
+            utilization.held[i] = (utilization.rates.rates[octets] +
+                                   LINK_FRAME_OVERHEAD_BYTES * utilization.rates.rates[pkts]) * 8;
+
+        utilization.utilization[i]->Set(speed > 0 ? utilization.held[i] / speed * 100 : 0);
+        utilization.headroom[i]->Set(std::max(speed - utilization.held[i], 0.0));
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/counter.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "rates.h"
+
+#include <mutex>
+#include <vector>
+
+using namespace prometheus;
+
+// Period at which the link tier drains port events
+const int LINK_EVENT_PERIOD_MS = 1000;
+
+// Bytes each frame occupies on the wire on top of its octets: 7 preamble, 1 start of frame delimiter, 12 IFG
+const int LINK_FRAME_OVERHEAD_BYTES = 20;
+
+// Negotiated link of every port, written by the link tier and read by the collection loop
+struct PortLinks
+{
+    std::mutex lock;
+    std::vector<double> speeds; // Bits per second, 0 while the link is down or unknown
+};
+
+// Reads NT_INFO_CMD_READ_PORT_V9 again for the ports an event stream reports link changes on
+struct LinkWatcher
+{
+    NtEventStream_t hEventStream;
+    NtInfoStream_t hInfoStream;
+    int ports_count;
+    Counter *events; // Link events seen so far
+};
+
+bool openLinkWatcher(LinkWatcher &links, Family<Counter> &counter_family, PortLinks &port_links, const int ports_count);
+void closeLinkWatcher(LinkWatcher &links);
+
+// Drains the pending port events and refreshes the links they concern, or all of them when ports_count changed
+void processLinkEvents(LinkWatcher &links, PortLinks &port_links, const int ports_count);
+
+// Line utilization of every port direction with RMON1 counters: RX and TX octets plus the per-frame preamble and IFG,
+// over the hardware sample interval, against the negotiated speed
+struct UtilizationTable
+{
+    RateEngine rates;                  // Octets then packets of each direction
+    std::vector<int> ports;            // Port of each direction
+    std::vector<double> held;          // Last wire rate of each direction, bits per second
+    std::vector<Gauge *> utilization;  // Percent of the link speed
+    std::vector<Gauge *> headroom;     // Bits per second left
+    std::vector<Gauge *> speeds;       // One per port
+};
+
+UtilizationTable bindUtilizationMetrics(const NtStatistics_t &hStat, Family<Gauge> &gauge_family, const int ports_count);
+
+std::vector<Gauge *> tableGauges(const UtilizationTable &table);
+
+// interval, in seconds, stands in for ports without time stamps
+void processUtilizationMetrics(const NtStatistics_t &hStat, UtilizationTable &utilization, PortLinks &port_links,
+                               const double interval);
@@ -0,0 +1,157 @@
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "loss.h"
+#include "metrics.h"
+#include "rates.h"
+#include "window.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace prometheus;
+
+const char *const LOSS_STAGE_NAMES[] = {
+    "received", "drop_mac_bandwidth", "drop_overflow", "drop_dedup", "drop_no_filter", "drop_filter",
+    "forward",  "drop",               "flush",         "unassigned", "residual",
+};
+
+static_assert(sizeof(LOSS_STAGE_NAMES) / sizeof(LOSS_STAGE_NAMES[0]) == LOSS_STAGES_COUNT,
+              "Every loss stage needs a name");
+
+// A counter feeding a stage
+struct LossCounter
+{
+    LossStage stage;
+    size_t offset;
+    size_t valid_offset;
+};
+
+#define LOSS_PORT_COUNTER(stage, group, field) \
+    { stage, offsetof(struct NtPortStatistics_v2_s, group.field), offsetof(struct NtPortStatistics_v2_s, valid.group) }
+
+static const LossCounter LOSS_PORT_COUNTERS[] = {
+    LOSS_PORT_COUNTER(LOSS_RECEIVED, RMON1, pkts),
+    LOSS_PORT_COUNTER(LOSS_DROP_MAC_BANDWIDTH, extDrop, pktsMacBandwidth),
+    LOSS_PORT_COUNTER(LOSS_DROP_OVERFLOW, extDrop, pktsOverflow),
+    LOSS_PORT_COUNTER(LOSS_DROP_DEDUP, extDrop, pktsDedup),
+    LOSS_PORT_COUNTER(LOSS_DROP_NO_FILTER, extDrop, pktsNoFilter),
+    LOSS_PORT_COUNTER(LOSS_DROP_FILTER, extDrop, pktsFilterDrop),
+};
+
+#define LOSS_STREAM_COUNTER(stage, block) \
+    { stage, offsetof(struct NtStatGroupStream_s, streamid[0].block.pkts), ALWAYS_VALID }
+
+static const LossCounter LOSS_STREAM_COUNTERS[] = {
+    LOSS_STREAM_COUNTER(LOSS_FORWARD, forward),
+    LOSS_STREAM_COUNTER(LOSS_DROP, drop),
+    LOSS_STREAM_COUNTER(LOSS_FLUSH, flush),
+};
+
+LossTable bindLossMetrics(const NtStatistics_t &hStat, Family<Gauge> &gauge_family, const int ports_count,
+                          const std::vector<int> &port_adapters, const int adapters_count,
+                          const std::vector<int> &stream_ids)
+{
+    const auto *data = &hStat.u.query_v3.data;
+    const size_t rx = 0; // PORT_DIRECTIONS index
+    LossTable loss;
+
+    loss.adapters_count = adapters_count;
+    loss.gauges.assign((adapters_count + 1) * LOSS_STAGES_COUNT, nullptr);
+
+    for (int p = 0; p < ports_count && p < static_cast<int>(port_adapters.size()); p++)
+    {
+        const int adapter = port_adapters[p];
+        const size_t direction_offset = portOffset(p, rx);
+        const char *statistics = reinterpret_cast<const char *>(data) + direction_offset;
+
+        if (adapter < 0 || adapter >= adapters_count)
+            continue;
+
+        const size_t clock = addPortClock(loss.rates, hStat, p);
+        for (const LossCounter &counter : LOSS_PORT_COUNTERS)
+        {
+            if (!counterValid(statistics, counter.valid_offset))
+                continue;
+
+            addRate(loss.rates, hStat, direction_offset + counter.offset, clock, nullptr, NO_WINDOW);
+            loss.stages.push_back(counter.stage);
+            loss.adapters.push_back(adapter);
+        }
+    }
+
+    const size_t stream_clock = addStreamClock(loss.rates, hStat);
+    for (const int s : streamBlocks(stream_ids))
+    {
+        for (const LossCounter &counter : LOSS_STREAM_COUNTERS)
+        {
+            addRate(loss.rates, hStat, streamOffset(s) + counter.offset, stream_clock, nullptr, NO_WINDOW);
+            loss.stages.push_back(s == UNASSIGNED_STREAM ? LOSS_UNASSIGNED : counter.stage);
+            loss.adapters.push_back(-1);
+        }
+    }
+
+    loss.held.assign(loss.stages.size(), 0.0);
+    loss.sums.assign(loss.gauges.size(), 0.0);
+
+    // Adapters get the port stages they have counters for, "all" gets every stage
+    for (size_t i = 0; i < loss.stages.size(); i++)
+    {
+        if (loss.adapters[i] < 0)
+            continue;
+
+        Gauge *&gauge = loss.gauges[loss.adapters[i] * LOSS_STAGES_COUNT + loss.stages[i]];
+        if (gauge == nullptr)
+            gauge = &gauge_family.Add({{"loss_pkts_rate", LOSS_STAGE_NAMES[loss.stages[i]]},
+                                       {"adapter", std::to_string(loss.adapters[i])}});
+    }
+    for (size_t stage = 0; stage < LOSS_STAGES_COUNT; stage++)
+        loss.gauges[adapters_count * LOSS_STAGES_COUNT + stage] =
+            &gauge_family.Add({{"loss_pkts_rate", LOSS_STAGE_NAMES[stage]}, {"adapter", "all"}});
+
+    return loss;
+}
+
+std::vector<Gauge *> tableGauges(const LossTable &table)
+{
+    std::vector<Gauge *> gauges;
+
+    for (Gauge *gauge : table.gauges)
+    {
+        if (gauge != nullptr)
+            gauges.push_back(gauge);
+    }
+
+    return gauges;
+}
+
+void processLossMetrics(const NtStatistics_t &hStat, LossTable &loss, const double interval)
+{
+    const size_t all = loss.adapters_count * LOSS_STAGES_COUNT;
+
+    processRates(loss.rates, hStat, nullptr, interval);
+    std::fill(loss.sums.begin(), loss.sums.end(), 0.0);
+
+    for (size_t i = 0; i < loss.stages.size(); i++)
+    {
+        if (loss.rates.inverse[i] != 0)
+            loss.held[i] = loss.rates.rates[i];
+
+        if (loss.adapters[i] >= 0)
+            loss.sums[loss.adapters[i] * LOSS_STAGES_COUNT + loss.stages[i]] += loss.held[i];
+        loss.sums[all + loss.stages[i]] += loss.held[i];
+    }
+
+    double residual = loss.sums[all + LOSS_RECEIVED];
+    for (size_t stage = LOSS_RECEIVED + 1; stage < LOSS_RESIDUAL; stage++)
+        residual -= loss.sums[all + stage];
+    loss.sums[all + LOSS_RESIDUAL] = residual;
+
+    for (size_t i = 0; i < loss.gauges.size(); i++)
+    {
+        if (loss.gauges[i] != nullptr)
+            loss.gauges[i]->Set(loss.sums[i]);
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "rates.h"
+
+#include <cstddef>
+#include <vector>
+
+using namespace prometheus;
+
+// Where received packets end up, exported as the "loss_pkts_rate" label.
+// Port stages are summed over the RX side of each adapter's ports, stream stages over the stream IDs.
+enum LossStage
+{
+    LOSS_RECEIVED,
+    LOSS_DROP_MAC_BANDWIDTH,
+    LOSS_DROP_OVERFLOW,
+    LOSS_DROP_DEDUP,
+    LOSS_DROP_NO_FILTER,
+    LOSS_DROP_FILTER,
+    LOSS_FORWARD,
+    LOSS_DROP,
+    LOSS_FLUSH,
+    LOSS_UNASSIGNED,
+    LOSS_RESIDUAL, // Received packets no other stage accounts for
+    LOSS_STAGES_COUNT
+};
+
+extern const char *const LOSS_STAGE_NAMES[];
+
+// Per-second balance of received packets against the stages they end in. Every counter is turned into a rate
+// over its own group's hardware time stamps, so ports and streams sampled at different times still line up.
+// Stream counters cover all adapters, so the full balance and its residual are only exported with adapter="all";
+// each adapter gets its own port stages.
+struct LossTable
+{
+    RateEngine rates;            // No gauges, rates are summed per stage
+    std::vector<size_t> stages;  // Stage of each rate
+    std::vector<int> adapters;   // Adapter of each rate, -1 for stream rates
+    std::vector<double> held;    // Last rate of each counter, kept while its group has no new sample
+    std::vector<double> sums;    // Preallocated per-stage sums, adapters_count + 1 rows
+    std::vector<Gauge *> gauges; // [adapter * LOSS_STAGES_COUNT + stage], nullptr where not exported, "all" last
+    int adapters_count;
+};
+
+// Binds the RX counters of every port and the stream blocks, using hStat as the first sample
+LossTable bindLossMetrics(const NtStatistics_t &hStat, Family<Gauge> &gauge_family, const int ports_count,
+                          const std::vector<int> &port_adapters, const int adapters_count,
+                          const std::vector<int> &stream_ids);
+
+std::vector<Gauge *> tableGauges(const LossTable &table);
+
+// interval, in seconds, stands in for groups without time stamps
+void processLossMetrics(const NtStatistics_t &hStat, LossTable &loss, const double interval);
@@ -2,22 +2,39 @@
 #include <prometheus/counter.h>
 #include <prometheus/exposer.h>
 #include <prometheus/gauge.h>
+#include <prometheus/histogram.h>
 #include <napatech/nt.h>
 #include "metrics.h"
+#include "derived.h"
+#include "colors.h"
+#include "usage.h"
+#include "flow.h"
+#include "discovery.h"
+#include "timestamps.h"
+#include "scheduler.h"
+#include "adaptive.h"
+#include "burst.h"
+#include "window.h"
+#include "continuity.h"
+#include "loss.h"
+#include "numa.h"
+#include "link.h"
+#include "rollup.h"
 
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <cstdlib>
+#include <map>
 #include <memory>
 #include <string>
 #include <thread>
+#include <utility>
 #include <iostream>
 #include <signal.h>
 
 #if defined(__linux__) || defined(__FreeBSD__)
-#include <unistd.h> // sleep()
-#elif defined(WIN32) || defined(WIN64)
-#include <winsock2.h> // Sleep()
+#include <unistd.h> // getopt()
 #endif
 
 using namespace prometheus;
@@ -42,29 +59,188 @@ static void sigproc_(int) noexcept {
     data_.stop_flag = 1;
 }
 
+// Port and stream series, rebound whenever discovery reports a different topology
+struct Series_ {
+    CounterTable port_counters;
+    HistogramTable port_histograms;
+    DerivedTable port_derived;
+    CounterTable stream_counters;
+    DerivedTable stream_derived;
+    WindowAggregator windows; // Companions of the derived rates and ratios
+    LossTable loss;
+    UtilizationTable utilization;
+    RollupTable rollups;
+};
+
+static void bindPorts_(Series_ &series, const NtStatistics_t &hStat, Family<Counter> &counter_family,
+                       Family<Gauge> &gauge_family, Family<Histogram> &histogram_family, Checkpoint &checkpoint,
+                       const int ports_count) {
+    const auto counters = tableCounters(series.port_counters);
+    const auto derived = tableGauges(series.port_derived);
+    const auto utilization = tableGauges(series.utilization);
+    const auto histograms = tableHistograms(series.port_histograms);
+
+    series.port_counters = bindPortMetrics(hStat, counter_family, checkpoint, ports_count);
+    series.port_histograms = bindPortHistograms(hStat, histogram_family, ports_count);
+    series.port_derived = bindPortDerivedMetrics(hStat, gauge_family, series.windows, ports_count);
+    series.utilization = bindUtilizationMetrics(hStat, gauge_family, ports_count);
+
+    removeStaleWindows(series.windows, derived, tableGauges(series.port_derived));
+    removeStaleMetrics(counter_family, counters, tableCounters(series.port_counters));
+    removeStaleMetrics(gauge_family, derived, tableGauges(series.port_derived));
+    removeStaleMetrics(gauge_family, utilization, tableGauges(series.utilization));
+    removeStaleMetrics(histogram_family, histograms, tableHistograms(series.port_histograms));
+}
+
+static void bindStreams_(Series_ &series, const NtStatistics_t &hStat, Family<Counter> &counter_family,
+                         Family<Gauge> &gauge_family, Checkpoint &checkpoint, const vector<int> &stream_ids) {
+    const auto counters = tableCounters(series.stream_counters);
+    const auto gauges = tableGauges(series.stream_derived);
+
+    series.stream_counters = bindStreamMetrics(counter_family, checkpoint, stream_ids);
+    series.stream_derived = bindStreamDerivedMetrics(hStat, gauge_family, series.windows, stream_ids);
+
+    const auto bound = tableGauges(series.stream_derived);
+    removeStaleWindows(series.windows, gauges, bound);
+    removeStaleMetrics(counter_family, counters, tableCounters(series.stream_counters));
+    removeStaleMetrics(gauge_family, gauges, bound);
+}
+
+static void bindLoss_(Series_ &series, const NtStatistics_t &hStat, Family<Gauge> &gauge_family,
+                      const Topology &topology) {
+    const auto gauges = tableGauges(series.loss);
+
+    series.loss = bindLossMetrics(hStat, gauge_family, topology.ports_count, topology.port_adapters,
+                                  topology.adapters_count, topology.stream_ids);
+    removeStaleMetrics(gauge_family, gauges, tableGauges(series.loss));
+}
+
+// Runs after bindPorts_() and bindStreams_(), the rollups point into their counter states
+static void bindRollups_(Series_ &series, const NtStatistics_t &hStat, Family<Counter> &counter_family,
+                         Family<Gauge> &gauge_family, Checkpoint &checkpoint, const Topology &topology) {
+    const auto counters = tableCounters(series.rollups);
+    const auto gauges = tableGauges(series.rollups);
+
+    series.rollups = bindRollupMetrics(hStat, counter_family, gauge_family, checkpoint, series.port_counters,
+                                       series.stream_counters, topology.ports_count, topology.port_adapters,
+                                       topology.stream_ids);
+    removeStaleMetrics(counter_family, counters, tableCounters(series.rollups));
+    removeStaleMetrics(gauge_family, gauges, tableGauges(series.rollups));
+}
+
+static void usage_() {
+    cout << "Usage: napatech_stat [-p period [-a period] [-c cooldown] | -s] [-u period] [-f period] [-d period] [-b period [-t rate]] [-w window] [-k checkpoint] [-r] <address> [colors]" << endl;
+    cout << "address: Hostname and port which should be accessible by the Prometheus metrics puller" << endl;
+    cout << "colors:  Optional file mapping NTPL color IDs to filter names, one \"<color> <name>\" per line" << endl;
+    cout << "-p:      Collection period in milliseconds, " << SCHEDULER_MIN_PERIOD_MS << " or more (default 10000)" << endl;
+    cout << "-a:      Switch to this shorter period while drops or sharp port rate changes are seen" << endl;
+    cout << "-c:      Milliseconds without drops or rate changes before -a falls back to -p (default 60000)" << endl;
+    cout << "-s:      Collect every counter set published by ntservice, waiting for each with NT_StatRead(poll = 0)" << endl;
+    cout << "-u:      Host-buffer usage period in milliseconds (default: the -p period)" << endl;
+    cout << "-f:      Flow matcher period in milliseconds (default: the -p period)" << endl;
+    cout << "-d:      Port, adapter and stream discovery and NUMA audit period in milliseconds (default 30000)" << endl;
+    cout << "-b:      Sample port and stream counters every " << BURST_MIN_PERIOD_MS << "-" << BURST_MAX_PERIOD_MS
+         << " milliseconds and export their peak rates per -p period" << endl;
+    cout << "-t:      Rate in Mbit/s above which -b sampling counts time above threshold (default 1000)" << endl;
+    cout << "-w:      Window in milliseconds of the _min, _max and _avg companions of rates and fill ratios (default 15000)" << endl;
+    cout << "-k:      File keeping the counter totals across restarts, rewritten every " << CHECKPOINT_PERIOD_MS / 1000
+         << " seconds and at exit" << endl;
+    cout << "-r:      Export only the adapter and host rollups of port series, not the per-port series" << endl;
+    cout << "Ports, adapters and streams are discovered automatically." << endl;
+    cout << "Example: ./napatech_stat -p 1000 -u 2000 yar-sniff-01:8080 /etc/napatech_stat/colors.conf" << endl;
+}
+
 int main(int argc, char* argv[])
 {
-    if (argc != 4) {
-        cout << "Pass 3 arguments:" << endl;
-        cout << "1. Hostname and port which should be accessible by the Prometheus metrics puller" << endl;
-        cout << "2. Number of Napatech ports" << endl;
-        cout << "3. Number of Napatech streams" << endl;
-        cout << "Example: ./napatech_stat yar-sniff-01:8080 2 32" << endl;
+    int period_ms = 10000;
+    int usage_period_ms = 0;
+    int flow_period_ms = 0;
+    int discovery_period_ms = 30000;
+    int fast_period_ms = 0;
+    int cooldown_ms = 60000;
+    int burst_period_ms = 0;
+    double burst_threshold_mbps = 1000;
+    int window_ms = 15000;
+    string checkpoint_path;
+    bool synchronized = false;
+    bool rollups_only = false;
+    int option;
 
+    while ((option = getopt(argc, argv, "p:a:c:su:f:d:b:t:w:k:r")) != -1) {
+        switch (option) {
+        case 'p':
+            period_ms = atoi(optarg);
+            break;
+        case 'a':
+            fast_period_ms = atoi(optarg);
+            break;
+        case 'c':
+            cooldown_ms = atoi(optarg);
+            break;
+        case 's':
+            synchronized = true;
+            break;
+        case 'u':
+            usage_period_ms = atoi(optarg);
+            break;
+        case 'f':
+            flow_period_ms = atoi(optarg);
+            break;
+        case 'd':
+            discovery_period_ms = atoi(optarg);
+            break;
+        case 'b':
+            burst_period_ms = atoi(optarg);
+            break;
+        case 't':
+            burst_threshold_mbps = atof(optarg);
+            break;
+        case 'w':
+            window_ms = atoi(optarg);
+            break;
+        case 'k':
+            checkpoint_path = optarg;
+            break;
+        case 'r':
+            rollups_only = true;
+            break;
+        default:
+            usage_();
+            return -1;
+        }
+    }
+    if (usage_period_ms == 0)
+        usage_period_ms = period_ms;
+    if (flow_period_ms == 0)
+        flow_period_ms = period_ms;
+    const bool adaptive_sampling = fast_period_ms != 0;
+    if (!adaptive_sampling)
+        fast_period_ms = period_ms;
+    if (min({period_ms, fast_period_ms, usage_period_ms, flow_period_ms, discovery_period_ms, window_ms}) < SCHEDULER_MIN_PERIOD_MS ||
+        fast_period_ms > period_ms || cooldown_ms < 0 || (adaptive_sampling && synchronized) ||
+        (burst_period_ms != 0 && (burst_period_ms < BURST_MIN_PERIOD_MS || burst_period_ms > BURST_MAX_PERIOD_MS)) ||
+        (argc - optind != 1 && argc - optind != 2)) {
+        usage_();
         return -1;
     }
 
     NtStatStream_t hStatStream;       // Statistics stream handle
     NtStatistics_t hStat;             // Stat handle.
-    NtInfo_t hInfo;
+    NtInfoStream_t hInfoStream;       // Info stream handle, used for discovery
     char errorBuffer[NT_ERRBUF_SIZE]; // Error buffer
     int status;                       // Status variable
-    const string PROMETHEUS_BIND_ADDRESS = argv[1];
-    const int NAPATECH_PORTS_COUNT = atoi(argv[2]);
-    const int NAPATECH_STREAMS_COUNT = atoi(argv[3]);
+    const string PROMETHEUS_BIND_ADDRESS = argv[optind];
+    map<int, string> color_names;
     int successful_pushes = 0;
     int failed_pushes = 0;
     
+    if (argc - optind == 2 && !loadColorNames(argv[optind + 1], color_names))
+        return -1;
+
+    Checkpoint checkpoint;
+    if (!checkpoint_path.empty() && !loadCheckpoint(checkpoint, checkpoint_path))
+        return -1;
+
     if ((status = NT_Init(NTAPI_VERSION)) != NT_SUCCESS)
     {
         // Get the status code as text
@@ -80,11 +256,19 @@ int main(int argc, char* argv[])
         fprintf(stderr, "NT_StatOpen() failed: %s\n", errorBuffer);
         return -1;
     }
-    // Read the statistics counters to clear the statistics
-    // This is an optional step. If omitted, the adapter will show statistics form the start of ntservice.
+    // Open the info stream
+    if ((status = NT_InfoOpen(&hInfoStream, "PrometheusInfo")) != NT_SUCCESS)
+    {
+        // Get the status code as text
+        NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+        fprintf(stderr, "NT_InfoOpen() failed: %s\n", errorBuffer);
+        return -1;
+    }
+    // Wait for a first counter set. Statistics are not cleared: counters continue from the checkpoint,
+    // or from the start of ntservice, and clearing would only hide traffic from the other stat streams.
     hStat.cmd = NT_STATISTICS_READ_CMD_QUERY_V3;
     hStat.u.query_v3.poll = 0;  // Wait for a new set
-    hStat.u.query_v3.clear = 1; // Clear statistics
+    hStat.u.query_v3.clear = 0; // Do not clear statistics
     if ((status = NT_StatRead(hStatStream, &hStat)) != NT_SUCCESS)
     {
         // Get the status code as text
@@ -92,48 +276,231 @@ int main(int argc, char* argv[])
         fprintf(stderr, "NT_StatRead() failed: %s\n", errorBuffer);
         return -1;
     }
+    Topology topology;
+    if (!discoverTopology(hInfoStream, topology))
+        return -1;
+    SharedTopology shared_topology{};
+    unsigned long topology_version = 0;
+    publishTopology(shared_topology, topology);
+    takeTopology(shared_topology, topology, topology_version);
+    printf("Discovered %d ports, %d adapters and %zu streams\n",
+           topology.ports_count, topology.adapters_count, topology.stream_ids.size());
     printf("--------------------------------start-------------------------------------------\n");
+    SampleTimestamps timestamps; // Outlives the exposer, which reads it on scrape
     Exposer exposer{PROMETHEUS_BIND_ADDRESS};
     auto registry = std::make_shared<Registry>();
 
+    auto &counter_family = BuildCounter()
+                        .Name("napatech_stat_total")
+                        .Help("Napatech counters, continuous across exporter and ntservice restarts")
+                        .Register(*registry);
+
     auto &gauge_family = BuildGauge()
                         .Name("napatech_stat")
                         .Help("Napatech statistics")
                         .Register(*registry);
 
-    // ask the exposer to scrape the registry on incoming HTTP requests
-    exposer.RegisterCollectable(registry);
+    auto &packet_size_family = BuildHistogram()
+                        .Name("napatech_port_packet_size_bytes")
+                        .Help("Napatech per-port packet size distribution")
+                        .Register(*registry);
+
+    // Min, max and mean over each window of the values sampled faster than they are scraped
+    const WindowFamilies window_families = {
+        &BuildGauge().Name("napatech_stat_min").Help("Napatech statistics, minimum over the last window").Register(*registry),
+        &BuildGauge().Name("napatech_stat_max").Help("Napatech statistics, maximum over the last window").Register(*registry),
+        &BuildGauge().Name("napatech_stat_avg").Help("Napatech statistics, mean over the last window").Register(*registry),
+    };
+
+    // Resolve every series once, the loop below only writes values
+    Series_ series;
+    openWindowAggregator(series.windows, window_families, window_ms);
+    bindPorts_(series, hStat, counter_family, gauge_family, packet_size_family, checkpoint, topology.ports_count);
+    bindStreams_(series, hStat, counter_family, gauge_family, checkpoint, topology.stream_ids);
+    bindLoss_(series, hStat, gauge_family, topology);
+    bindRollups_(series, hStat, counter_family, gauge_family, checkpoint, topology);
+    auto adapter_colors = bindColorMetrics(hStat, color_names);
+
+    UsageCollector usage;
+    if (!openUsageCollector(usage, gauge_family, window_families, window_ms))
+        return -1;
+
+    FlowCollector flow;
+    if (!openFlowCollector(flow, gauge_family, topology.adapters_count))
+        return -1;
+
+    auto previous_read = chrono::steady_clock::now();
+
+    // ask the exposer to scrape the registry on incoming HTTP requests, stamped with the hardware sample time
+    updateSampleTimestamps(hStat, timestamps, topology.ports_count, topology.adapters_count);
+    auto timestamped = std::make_shared<TimestampedCollectable>(registry, timestamps, rollups_only);
+    exposer.RegisterCollectable(timestamped);
 
     hStat.cmd = NT_STATISTICS_READ_CMD_QUERY_V3;
     hStat.u.query_v3.poll = 1;  // The the current counters
     hStat.u.query_v3.clear = 0; // Do not clear statistics
 
+    // Either ntservice paces the counter reads or the timer does
+    Scheduler scheduler;
+    SyncReader sync_reader;
+    if (synchronized)
+        openSyncReader(sync_reader, hStatStream, gauge_family);
+    else
+        openScheduler(scheduler, gauge_family, "counters", period_ms, 0);
+
+    AdaptiveController adaptive;
+    if (adaptive_sampling)
+        openAdaptiveController(adaptive, gauge_family, period_ms, fast_period_ms, cooldown_ms, hStat, topology.ports_count);
+
+    PortLinks port_links;
+    LinkWatcher links;
+    if (!openLinkWatcher(links, counter_family, port_links, topology.ports_count))
+        return -1;
+
+    // Opened before any tier starts, returning once they run would leave joinable threads behind
+    BurstSampler burst;
+    if (burst_period_ms != 0 && !openBurstSampler(burst, gauge_family, burst_threshold_mbps * 1e6 / 8, period_ms))
+    {
+        closeLinkWatcher(links);
+        return -1;
+    }
+
+    // Slower sources run in their own tiers, phased across the counters period so they don't fire together
+    Scheduler usage_scheduler;
+    Topology usage_topology = topology;
+    unsigned long usage_version = topology_version;
+    openScheduler(usage_scheduler, gauge_family, "host_buffers", usage_period_ms, period_ms / 4);
+    thread usage_tier = runTier(usage_scheduler, [&] {
+        takeTopology(shared_topology, usage_topology, usage_version);
+        processUsageMetrics(usage, usage_topology.stream_ids);
+    }, data_.stop_flag);
+
+    Scheduler flow_scheduler;
+    openScheduler(flow_scheduler, gauge_family, "flow", flow_period_ms, period_ms / 2);
+    Topology flow_topology = topology;
+    unsigned long flow_version = topology_version;
+    thread flow_tier = runTier(flow_scheduler, [&] {
+        if (takeTopology(shared_topology, flow_topology, flow_version))
+            bindFlowAdapters(flow, gauge_family, flow_topology.adapters_count);
+        processFlowMetrics(flow);
+    }, data_.stop_flag);
+
+    // Follow ports and stream IDs appearing or going away without a restart,
+    // and audit where their host buffers landed right after
+    Scheduler discovery_scheduler;
+    NumaAudit numa;
+    openNumaAudit(numa, gauge_family);
+    openScheduler(discovery_scheduler, gauge_family, "discovery", discovery_period_ms, period_ms * 3 / 4);
+    thread discovery_tier = runTier(discovery_scheduler, [&] {
+        Topology discovered;
+        if (!discoverTopology(hInfoStream, discovered))
+            return;
+        publishTopology(shared_topology, discovered);
+        processNumaAudit(numa, hInfoStream, discovered);
+    }, data_.stop_flag);
+
+    // Link speeds, refreshed on port link events
+    Scheduler links_scheduler;
+    Topology links_topology = topology;
+    unsigned long links_version = topology_version;
+    openScheduler(links_scheduler, gauge_family, "links", LINK_EVENT_PERIOD_MS, 0);
+    thread links_tier = runTier(links_scheduler, [&] {
+        takeTopology(shared_topology, links_topology, links_version);
+        processLinkEvents(links, port_links, links_topology.ports_count);
+    }, data_.stop_flag);
+
+    // Micro-burst sampling, peaks are published once per counters period
+    Scheduler burst_scheduler;
+    thread burst_tier;
+    if (burst_period_ms != 0)
+    {
+        openScheduler(burst_scheduler, gauge_family, "bursts", burst_period_ms, 0);
+        burst_tier = runTier(burst_scheduler, [&] { processBurstSampler(burst, shared_topology); }, data_.stop_flag);
+    }
+
+    int exit_status = 0;
+    Topology taken_topology; // Scratch for discovery updates, swapped with topology so steady cycles copy nothing
     while (data_.stop_flag != 1)
     {
-        if ((status = NT_StatRead(hStatStream, &hStat)) != NT_SUCCESS)
+        if (synchronized)
+        {
+            // No new set yet, check the stop flag and keep waiting
+            if ((status = readNextUpdate(sync_reader, hStat)) == NT_STATUS_TIMEOUT)
+                continue;
+        }
+        else
+        {
+            status = NT_StatRead(hStatStream, &hStat);
+        }
+        if (status != NT_SUCCESS)
         {
             // Get the status code as text
             NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
             fprintf(stderr, "NT_StatRead() failed: %s\n", errorBuffer);
-            return -1;
+            exit_status = -1;
+            data_.stop_flag = 1;
+            break;
         }
+        if (takeTopology(shared_topology, taken_topology, topology_version))
+        {
+            std::swap(topology, taken_topology);
+            if (topology.ports_count != taken_topology.ports_count)
+                bindPorts_(series, hStat, counter_family, gauge_family, packet_size_family, checkpoint,
+                           topology.ports_count);
+            if (topology.stream_ids != taken_topology.stream_ids)
+                bindStreams_(series, hStat, counter_family, gauge_family, checkpoint, topology.stream_ids);
+            bindLoss_(series, hStat, gauge_family, topology);
+            bindRollups_(series, hStat, counter_family, gauge_family, checkpoint, topology);
+        }
+        const auto current_read = chrono::steady_clock::now();
+        const double interval = chrono::duration<double>(current_read - previous_read).count();
+        previous_read = current_read;
+        updateSampleTimestamps(hStat, timestamps, topology.ports_count, topology.adapters_count);
 
         if (hStat.u.query_v3.data.port.aPorts[0].rx.valid.RMON1)
         {
-            processPortMetrics(hStat, gauge_family, NAPATECH_PORTS_COUNT);
-            processStreamMetrics(hStat, gauge_family, NAPATECH_STREAMS_COUNT);
+            processPortMetrics(hStat, series.port_counters);
+            processStreamMetrics(hStat, series.stream_counters);
+            processPortHistograms(hStat, series.port_histograms);
+            processDerivedMetrics(hStat, series.port_derived, series.windows, interval);
+            processDerivedMetrics(hStat, series.stream_derived, series.windows, interval);
+            closeDueWindow(series.windows);
+            processLossMetrics(hStat, series.loss, interval);
+            processUtilizationMetrics(hStat, series.utilization, port_links, interval);
+            processRollupMetrics(hStat, series.rollups, interval);
+            processColorMetrics(hStat, counter_family, gauge_family, adapter_colors, checkpoint, topology.adapters_count,
+                                interval);
+            saveDueCheckpoint(checkpoint);
         }
         else
         {
             printf("Port0 doesn't support RMON1 RX counters.\n");
         }
-// Sleep 10 sec
-#if defined(__linux__) || defined(__FreeBSD__)
-        sleep(10);
-#elif defined(WIN32) || defined(WIN64)
-        Sleep(10000); // sleep 1000 milliseconds = 1 second
-#endif
+        if (adaptive_sampling)
+            setSchedulerPeriod(scheduler, adaptSamplingPeriod(adaptive, hStat, topology.ports_count, interval));
+        if (!synchronized)
+            waitNextTick(scheduler, data_.stop_flag);
     }
+    usage_tier.join();
+    flow_tier.join();
+    discovery_tier.join();
+    links_tier.join();
+    closeLinkWatcher(links);
+    if (burst_tier.joinable())
+    {
+        burst_tier.join();
+        closeBurstSampler(burst);
+    }
+    // A synchronized read still blocked inside NTAPI keeps the stat stream and the library in use
+    const bool read_done = !synchronized || closeSyncReader(sync_reader);
+    saveCheckpoint(checkpoint);
+    closeUsageCollector(usage);
+    closeFlowCollector(flow);
+    NT_InfoClose(hInfoStream);
+
+    if (!read_done)
+        return -1;
+
     // Close the stat stream
     if ((status = NT_StatClose(hStatStream)) != NT_SUCCESS)
     {
@@ -145,5 +512,5 @@ int main(int argc, char* argv[])
     // Close down the NTAPI library
     NT_Done();
     printf("Done.\n");
-    return 0;
+    return exit_status;
 }
\ No newline at end of file
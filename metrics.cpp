@@ -1,42 +1,289 @@
 #include <prometheus/registry.h>
+#include <prometheus/counter.h>
 #include <prometheus/gauge.h>
+#include <prometheus/histogram.h>
 #include <napatech/nt.h>
+#include "metrics.h"
+#include "continuity.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
 
 using namespace prometheus;
 
-void processPortMetrics(const NtStatistics_t &hStat, Family<Gauge> &gauge_family, const int ports_count)
+#define PORT_COUNTER(group, field, type, name) \
+    { offsetof(struct NtPortStatistics_v2_s, group.field), type, name, offsetof(struct NtPortStatistics_v2_s, valid.group) }
+
+#define STREAM_COUNTER(block, field, type, name) \
+    { offsetof(struct NtStatGroupStream_s, streamid[0].block.field), type, name, ALWAYS_VALID }
+
+#define SIZE_BUCKET(group, field, upper_bound) \
+    { offsetof(struct NtPortStatistics_v2_s, group.field), offsetof(struct NtPortStatistics_v2_s, valid.group), upper_bound }
+
+const CounterDescriptor PORT_COUNTERS[] = {
+    PORT_COUNTER(RMON1, pkts, "pkts_count", "total"),
+    PORT_COUNTER(RMON1, octets, "bytes_count", "total"),
+    PORT_COUNTER(RMON1, dropEvents, "pkts_count", "drop"),
+    PORT_COUNTER(RMON1, broadcastPkts, "pkts_count", "broadcast"),
+    PORT_COUNTER(RMON1, multicastPkts, "pkts_count", "multicast"),
+    PORT_COUNTER(RMON1, crcAlignErrors, "pkts_count", "crc_align_errors"),
+    PORT_COUNTER(RMON1, undersizePkts, "pkts_count", "undersize"),
+    PORT_COUNTER(RMON1, oversizePkts, "pkts_count", "oversize"),
+    PORT_COUNTER(RMON1, fragments, "pkts_count", "fragments"),
+    PORT_COUNTER(RMON1, jabbers, "pkts_count", "jabbers"),
+    PORT_COUNTER(RMON1, collisions, "pkts_count", "collisions"),
+
+    PORT_COUNTER(extRMON, unicastPkts, "pkts_count", "unicast"),
+    PORT_COUNTER(extRMON, pktsCrc, "pkts_count", "crc_errors"),
+    PORT_COUNTER(extRMON, pktsAlignment, "pkts_count", "alignment_errors"),
+    PORT_COUNTER(extRMON, pktsCodeViolation, "pkts_count", "code_violation_errors"),
+    PORT_COUNTER(extRMON, pktsRetransmit, "pkts_count", "retransmit"),
+    PORT_COUNTER(extRMON, pktsHardSlice, "pkts_count", "hard_slice"),
+    PORT_COUNTER(extRMON, pktsHardSliceJabber, "pkts_count", "hard_slice_jabber"),
+
+    PORT_COUNTER(chksum, pktsIpChkSumError, "pkts_count", "ip_checksum_errors"),
+    PORT_COUNTER(chksum, pktsUdpChkSumError, "pkts_count", "udp_checksum_errors"),
+    PORT_COUNTER(chksum, pktsTcpChkSumError, "pkts_count", "tcp_checksum_errors"),
+
+    PORT_COUNTER(decode, pktsGiantUndersize, "pkts_count", "giant_undersize"),
+    PORT_COUNTER(decode, pktsBabyGiant, "pkts_count", "baby_giant"),
+    PORT_COUNTER(decode, pktsNotIslVlanMpls, "pkts_count", "not_isl_vlan_mpls"),
+    PORT_COUNTER(decode, pktsIsl, "pkts_count", "isl"),
+    PORT_COUNTER(decode, pktsVlan, "pkts_count", "vlan"),
+    PORT_COUNTER(decode, pktsIslVlan, "pkts_count", "isl_vlan"),
+    PORT_COUNTER(decode, pktsMpls, "pkts_count", "mpls"),
+    PORT_COUNTER(decode, pktsIslMpls, "pkts_count", "isl_mpls"),
+    PORT_COUNTER(decode, pktsVlanMpls, "pkts_count", "vlan_mpls"),
+    PORT_COUNTER(decode, pktsIslVlanMpls, "pkts_count", "isl_vlan_mpls"),
+    PORT_COUNTER(decode, pktsDuplicate, "pkts_count", "duplicate"),
+
+    PORT_COUNTER(extDrop, pktsMacBandwidth, "pkts_count", "drop_mac_bandwidth"),
+    PORT_COUNTER(extDrop, pktsOverflow, "pkts_count", "drop_overflow"),
+    PORT_COUNTER(extDrop, octetsOverflow, "bytes_count", "drop_overflow"),
+    PORT_COUNTER(extDrop, pktsDedup, "pkts_count", "drop_dedup"),
+    PORT_COUNTER(extDrop, octetsDedup, "bytes_count", "drop_dedup"),
+    PORT_COUNTER(extDrop, pktsNoFilter, "pkts_count", "drop_no_filter"),
+    PORT_COUNTER(extDrop, octetsNoFilter, "bytes_count", "drop_no_filter"),
+    PORT_COUNTER(extDrop, pktsFilterDrop, "pkts_count", "drop_filter"),
+    PORT_COUNTER(extDrop, octetsFilterDrop, "bytes_count", "drop_filter"),
+
+    PORT_COUNTER(ipf, ipFragTableFirstHit, "pkts_count", "ipf_first_hit"),
+    PORT_COUNTER(ipf, ipFragTableFirstNoHit, "pkts_count", "ipf_first_no_hit"),
+    PORT_COUNTER(ipf, ipFragTableMidHit, "pkts_count", "ipf_mid_hit"),
+    PORT_COUNTER(ipf, ipFragTableMidNoHit, "pkts_count", "ipf_mid_no_hit"),
+    PORT_COUNTER(ipf, ipFragTableLastHit, "pkts_count", "ipf_last_hit"),
+    PORT_COUNTER(ipf, ipFragTableLastNoHit, "pkts_count", "ipf_last_no_hit"),
+};
+const size_t PORT_COUNTERS_COUNT = sizeof(PORT_COUNTERS) / sizeof(PORT_COUNTERS[0]);
+
+// Packet-size buckets in ascending order, with the hardware edges. The 8192-MAX bucket has no upper bound.
+const SizeBucketDescriptor PORT_SIZE_BUCKETS[] = {
+    SIZE_BUCKET(RMON1, pkts64Octets, 64),
+    SIZE_BUCKET(RMON1, pkts65to127Octets, 127),
+    SIZE_BUCKET(RMON1, pkts128to255Octets, 255),
+    SIZE_BUCKET(RMON1, pkts256to511Octets, 511),
+    SIZE_BUCKET(RMON1, pkts512to1023Octets, 1023),
+    SIZE_BUCKET(RMON1, pkts1024to1518Octets, 1518),
+    SIZE_BUCKET(extRMON, pkts1519to2047Octets, 2047),
+    SIZE_BUCKET(extRMON, pkts2048to4095Octets, 4095),
+    SIZE_BUCKET(extRMON, pkts4096to8191Octets, 8191),
+    SIZE_BUCKET(extRMON, pkts8192toMaxOctets, std::numeric_limits<double>::infinity()),
+};
+const size_t PORT_SIZE_BUCKETS_COUNT = sizeof(PORT_SIZE_BUCKETS) / sizeof(PORT_SIZE_BUCKETS[0]);
+
+const CounterDescriptor STREAM_COUNTERS[] = {
+    STREAM_COUNTER(forward, pkts, "pkts_count", "forward"),
+    STREAM_COUNTER(forward, octets, "bytes_count", "forward"),
+    STREAM_COUNTER(flush, pkts, "pkts_count", "flush"),
+    STREAM_COUNTER(flush, octets, "bytes_count", "flush"),
+    STREAM_COUNTER(drop, pkts, "pkts_count", "drop"),
+    STREAM_COUNTER(drop, octets, "bytes_count", "drop"),
+};
+const size_t STREAM_COUNTERS_COUNT = sizeof(STREAM_COUNTERS) / sizeof(STREAM_COUNTERS[0]);
+
+const PortDirection PORT_DIRECTIONS[] = {
+    {"rx", offsetof(struct NtStatGroupport_v2_s, rx)},
+    {"tx", offsetof(struct NtStatGroupport_v2_s, tx)},
+};
+const size_t PORT_DIRECTIONS_COUNT = sizeof(PORT_DIRECTIONS) / sizeof(PORT_DIRECTIONS[0]);
+
+std::vector<Counter *> tableCounters(const CounterTable &table)
 {
+    std::vector<Counter *> counters;
+
+    for (const BoundCounter &counter : table.counters)
+        counters.push_back(counter.counter);
+
+    return counters;
+}
+
+std::vector<Histogram *> tableHistograms(const HistogramTable &table)
+{
+    std::vector<Histogram *> histograms;
+
+    for (const BoundHistogram &histogram : table.histograms)
+        histograms.push_back(histogram.histogram);
+
+    return histograms;
+}
+
+CounterTable bindPortMetrics(const NtStatistics_t &hStat, Family<Counter> &counter_family, Checkpoint &checkpoint,
+                             const int ports_count)
+{
+    const auto &data = hStat.u.query_v3.data;
+    CounterTable ports;
+
     for (int p = 0; p < ports_count; p++)
     {
-        const std::string port = std::to_string(p).c_str();
-
-        auto &pkts_count_total = gauge_family.Add({{"pkts_count", "total"}, {"port", port}});
-        auto &pkts_count_drop = gauge_family.Add({{"pkts_count", "drop"}, {"port", port}});
-        auto &pkts_count_multicast = gauge_family.Add({{"pkts_count", "multicast"}, {"port", port}});
-        auto &pkts_count_vlan = gauge_family.Add({{"pkts_count", "vlan"}, {"port", port}});
-        auto &bytes_count_total = gauge_family.Add({{"bytes_count", "total"}, {"port", port}});
-
-        pkts_count_total.Set(hStat.u.query_v3.data.port.aPorts[p].rx.RMON1.pkts);
-        pkts_count_drop.Set(hStat.u.query_v3.data.port.aPorts[p].rx.RMON1.dropEvents);
-        pkts_count_multicast.Set(hStat.u.query_v3.data.port.aPorts[p].rx.RMON1.multicastPkts);
-        pkts_count_vlan.Set(hStat.u.query_v3.data.port.aPorts[p].rx.decode.pktsVlan);
-        bytes_count_total.Set(hStat.u.query_v3.data.port.aPorts[p].rx.RMON1.octets);
+        const std::string port = std::to_string(p);
+
+        for (size_t d = 0; d < PORT_DIRECTIONS_COUNT; d++)
+        {
+            const size_t direction_offset = portOffset(p, d);
+            const char *statistics = reinterpret_cast<const char *>(&data) + direction_offset;
+
+            for (size_t c = 0; c < PORT_COUNTERS_COUNT; c++)
+            {
+                if (!counterValid(statistics, PORT_COUNTERS[c].valid_offset))
+                    continue;
+
+                BoundCounter counter;
+                counter.offset = direction_offset + PORT_COUNTERS[c].offset;
+                counter.counter = &addContinuousCounter(counter_family, checkpoint,
+                                                        {{PORT_COUNTERS[c].type, PORT_COUNTERS[c].name},
+                                                         {"port", port},
+                                                         {"direction", PORT_DIRECTIONS[d].name}},
+                                                        counter.state);
+                ports.counters.push_back(counter);
+            }
+        }
     }
+
+    return ports;
 }
 
-void processStreamMetrics(const NtStatistics_t &hStat, Family<Gauge> &gauge_family, const int streams_count)
+CounterTable bindStreamMetrics(Family<Counter> &counter_family, Checkpoint &checkpoint, const std::vector<int> &stream_ids)
 {
-    for (int s = 0; s < streams_count; s++) {
-        const std::string stream_id = std::to_string(s).c_str();
+    CounterTable streams;
 
-        auto &pkts_count_forward = gauge_family.Add({{"pkts_count", "forward"}, {"stream_id", stream_id}});
-        auto &pkts_count_drop = gauge_family.Add({{"pkts_count", "drop"}, {"stream_id", stream_id}});
-        auto &bytes_count_total = gauge_family.Add({{"bytes_count", "forward"}, {"stream_id", stream_id}});
-        auto &bytes_count_drop = gauge_family.Add({{"bytes_count", "drop"}, {"stream_id", stream_id}});
+    for (const int s : streamBlocks(stream_ids)) {
+        const std::string stream_id = streamLabel(s);
+        const size_t stream_offset = streamOffset(s);
 
-        pkts_count_forward.Set(hStat.u.query_v3.data.stream.streamid[s].forward.pkts);
-        pkts_count_drop.Set(hStat.u.query_v3.data.stream.streamid[s].drop.pkts);
-        bytes_count_total.Set(hStat.u.query_v3.data.stream.streamid[s].forward.octets);
-        bytes_count_drop.Set(hStat.u.query_v3.data.stream.streamid[s].drop.octets);
+        for (size_t c = 0; c < STREAM_COUNTERS_COUNT; c++) {
+            BoundCounter counter;
+            counter.offset = stream_offset + STREAM_COUNTERS[c].offset;
+            counter.counter = &addContinuousCounter(counter_family, checkpoint,
+                                                    {{STREAM_COUNTERS[c].type, STREAM_COUNTERS[c].name}, {"stream_id", stream_id}},
+                                                    counter.state);
+            streams.counters.push_back(counter);
+        }
     }
-}
\ No newline at end of file
+
+    return streams;
+}
+
+HistogramTable bindPortHistograms(const NtStatistics_t &hStat, Family<Histogram> &histogram_family, const int ports_count)
+{
+    const auto &data = hStat.u.query_v3.data;
+    HistogramTable histograms;
+
+    for (int p = 0; p < ports_count; p++)
+    {
+        const std::string port = std::to_string(p);
+
+        for (size_t d = 0; d < PORT_DIRECTIONS_COUNT; d++)
+        {
+            const size_t direction_offset = portOffset(p, d);
+            const auto &statistics = *reinterpret_cast<const struct NtPortStatistics_v2_s *>(
+                reinterpret_cast<const char *>(&data) + direction_offset);
+
+            if (!statistics.valid.RMON1)
+                continue;
+
+            BoundHistogram histogram;
+            Histogram::BucketBoundaries boundaries;
+            size_t inf_offset = NO_COUNTER;
+
+            for (size_t b = 0; b < PORT_SIZE_BUCKETS_COUNT; b++)
+            {
+                const SizeBucketDescriptor &bucket = PORT_SIZE_BUCKETS[b];
+
+                if (!counterValid(&statistics, bucket.valid_offset))
+                    continue;
+
+                if (bucket.upper_bound == std::numeric_limits<double>::infinity())
+                {
+                    inf_offset = direction_offset + bucket.offset;
+                    continue;
+                }
+
+                boundaries.push_back(bucket.upper_bound);
+                histogram.bucket_offsets.push_back(direction_offset + bucket.offset);
+            }
+            // Without extRMON, +Inf takes the RMON1 packets the buckets up to 1518 bytes leave out
+            histogram.inf_remainder = inf_offset == NO_COUNTER;
+            if (histogram.inf_remainder)
+                inf_offset = direction_offset + offsetof(struct NtPortStatistics_v2_s, RMON1.pkts);
+            histogram.bucket_offsets.push_back(inf_offset);
+            histogram.octets_offset = direction_offset + offsetof(struct NtPortStatistics_v2_s, RMON1.octets);
+
+            for (const size_t offset : histogram.bucket_offsets)
+                histogram.previous.push_back(counterAt(&data, offset));
+            histogram.previous.push_back(counterAt(&data, histogram.octets_offset));
+            histogram.increments.assign(histogram.bucket_offsets.size(), 0.0);
+            histogram.histogram = &histogram_family.Add({{"port", port}, {"direction", PORT_DIRECTIONS[d].name}},
+                                                        boundaries);
+            histograms.histograms.push_back(histogram);
+        }
+    }
+
+    return histograms;
+}
+
+// Counters are absolute while Histogram only accepts observations,
+// so every cycle feeds the per-bucket increase since the previous one
+void processPortHistograms(const NtStatistics_t &hStat, HistogramTable &histograms)
+{
+    const auto *data = &hStat.u.query_v3.data;
+
+    for (BoundHistogram &histogram : histograms.histograms)
+    {
+        const size_t buckets_count = histogram.bucket_offsets.size();
+
+        for (size_t b = 0; b < buckets_count; b++)
+            histogram.increments[b] = counterDelta(counterAt(data, histogram.bucket_offsets[b]), histogram.previous[b]);
+
+        if (histogram.inf_remainder)
+        {
+            double inf = histogram.increments[buckets_count - 1];
+            for (size_t b = 0; b + 1 < buckets_count; b++)
+                inf -= histogram.increments[b];
+            histogram.increments[buckets_count - 1] = std::max(inf, 0.0);
+        }
+
+        const uint64_t octets = counterDelta(counterAt(data, histogram.octets_offset), histogram.previous[buckets_count]);
+        histogram.histogram->ObserveMultiple(histogram.increments, octets);
+    }
+}
+
+static void processCounters(const NtStatistics_t &hStat, const CounterTable &table)
+{
+    const auto *data = &hStat.u.query_v3.data;
+
+    for (const BoundCounter &counter : table.counters)
+        advanceCounter(*counter.counter, *counter.state, counterAt(data, counter.offset));
+}
+
+void processPortMetrics(const NtStatistics_t &hStat, const CounterTable &ports)
+{
+    processCounters(hStat, ports);
+}
+
+void processStreamMetrics(const NtStatistics_t &hStat, const CounterTable &streams)
+{
+    processCounters(hStat, streams);
+}
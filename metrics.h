@@ -1,12 +1,180 @@
 #pragma once
 
 #include <prometheus/registry.h>
+#include <prometheus/counter.h>
 #include <prometheus/gauge.h>
+#include <prometheus/histogram.h>
 #include <napatech/nt.h>
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
 using namespace prometheus;
 
 static void sigproc_(int) noexcept;
 
-void processPortMetrics(const NtStatistics_t &hStat, Family<Gauge> &gauge_family, const int ports_count);
-void processStreamMetrics(const NtStatistics_t &hStat, Family<Gauge> &gauge_family, const int streams_count);
\ No newline at end of file
+struct Checkpoint;
+struct CounterState;
+
+typedef NtStatisticsQuery_v3_s::NtStatisticsQueryResult_v3_s QueryResult;
+
+// Compile-time description of one hardware counter
+struct CounterDescriptor
+{
+    size_t offset;       // Offset of the uint64_t counter inside its statistics structure
+    const char *type;    // Label name: "pkts_count" or "bytes_count"
+    const char *name;    // Label value, e.g. "total" or "overflow"
+    size_t valid_offset; // Offset of the int flag telling whether the counter is supported
+};
+
+// Counters without a validity flag (stream counters)
+const size_t ALWAYS_VALID = static_cast<size_t>(-1);
+
+// No counter backs this slot
+const size_t NO_COUNTER = static_cast<size_t>(-1);
+
+// One packet-size bucket of the per-port histogram
+struct SizeBucketDescriptor
+{
+    size_t offset;       // Offset of the uint64_t bucket counter inside NtPortStatistics_v2_s
+    size_t valid_offset; // Offset of the int flag telling whether the bucket is supported
+    double upper_bound;  // Largest packet size counted by the bucket, infinity for the last one
+};
+
+// A series resolved at startup: where its value lives inside NtStatisticsQueryResult_v3_s
+// and which counter it advances
+struct BoundCounter
+{
+    size_t offset;
+    CounterState *state; // Owned by the Checkpoint
+    Counter *counter;
+};
+
+// Flat handle table holding only the series supported by the adapter
+struct CounterTable
+{
+    std::vector<BoundCounter> counters;
+};
+
+// Packet-size histogram of one port direction, fed with bucket increments since the previous cycle.
+// bucket_offsets has one entry per histogram bucket, the last one being +Inf. Without extRMON the buckets stop at
+// 1518 bytes and +Inf gets the RMON1 packets no other bucket counted: frames over 1518 bytes, along with any frame
+// the RMON1 buckets leave out, such as undersized ones. _count then matches the RMON1 packets, as _sum does the octets.
+struct BoundHistogram
+{
+    std::vector<size_t> bucket_offsets; // The last one is RMON1 pkts when inf_remainder is set
+    size_t octets_offset;
+    bool inf_remainder;                 // +Inf is the RMON1 packets minus the other buckets
+    std::vector<uint64_t> previous;     // Bucket counters, then octets, as read in the previous cycle
+    std::vector<double> increments; // Preallocated ObserveMultiple() argument
+    Histogram *histogram;
+};
+
+struct HistogramTable
+{
+    std::vector<BoundHistogram> histograms;
+};
+
+// Port statistics directions, exported as the "direction" label
+struct PortDirection
+{
+    const char *name;
+    size_t offset; // Offset of the NtPortStatistics_v2_s block inside NtStatGroupport_v2_s
+};
+
+inline uint64_t counterAt(const void *base, const size_t offset)
+{
+    return *reinterpret_cast<const uint64_t *>(static_cast<const char *>(base) + offset);
+}
+
+inline bool counterValid(const void *base, const size_t valid_offset)
+{
+    return valid_offset == ALWAYS_VALID ||
+           *reinterpret_cast<const int *>(static_cast<const char *>(base) + valid_offset) != 0;
+}
+
+// Increase of a counter since the previous read, updates previous.
+// A value going backwards means the counters were cleared.
+inline uint64_t counterDelta(const uint64_t current, uint64_t &previous)
+{
+    const uint64_t delta = current >= previous ? current - previous : current;
+    previous = current;
+    return delta;
+}
+
+extern const PortDirection PORT_DIRECTIONS[];
+extern const size_t PORT_DIRECTIONS_COUNT;
+extern const CounterDescriptor PORT_COUNTERS[];
+extern const size_t PORT_COUNTERS_COUNT;
+extern const SizeBucketDescriptor PORT_SIZE_BUCKETS[];
+extern const size_t PORT_SIZE_BUCKETS_COUNT;
+extern const CounterDescriptor STREAM_COUNTERS[];
+extern const size_t STREAM_COUNTERS_COUNT;
+
+// Offset of a port direction block inside QueryResult
+inline size_t portOffset(const int port, const size_t direction)
+{
+    return offsetof(QueryResult, port.aPorts) + port * sizeof(struct NtStatGroupport_v2_s) +
+           PORT_DIRECTIONS[direction].offset;
+}
+
+// Stream index of the Unassigned block, traffic received before a stream ID is assigned.
+// It is laid out like streamid[] and exported with stream_id="unassigned".
+const int UNASSIGNED_STREAM = -1;
+
+// Offset of a stream counters block inside QueryResult
+inline size_t streamOffset(const int stream)
+{
+    static_assert(sizeof(QueryResult().stream.Unassigned) == sizeof(QueryResult().stream.streamid[0]),
+                  "Unassigned and streamid[] counters must share their layout");
+
+    if (stream == UNASSIGNED_STREAM)
+        return offsetof(QueryResult, stream.Unassigned);
+
+    return offsetof(QueryResult, stream) + stream * sizeof(QueryResult().stream.streamid[0]);
+}
+
+inline std::string streamLabel(const int stream)
+{
+    return stream == UNASSIGNED_STREAM ? "unassigned" : std::to_string(stream);
+}
+
+// Stream counter blocks to export: the Unassigned block followed by the given stream IDs
+inline std::vector<int> streamBlocks(const std::vector<int> &stream_ids)
+{
+    std::vector<int> blocks(1, UNASSIGNED_STREAM);
+    blocks.insert(blocks.end(), stream_ids.begin(), stream_ids.end());
+    return blocks;
+}
+
+// Removes the metrics of a replaced table that the new table doesn't reuse.
+// Family::Add() returns the existing metric for known labels, so rebinding keeps surviving series.
+template <typename T>
+void removeStaleMetrics(Family<T> &family, const std::vector<T *> &before, const std::vector<T *> &after)
+{
+    for (T *metric : before)
+    {
+        if (std::find(after.begin(), after.end(), metric) == after.end())
+            family.Remove(metric);
+    }
+}
+
+std::vector<Counter *> tableCounters(const CounterTable &table);
+std::vector<Histogram *> tableHistograms(const HistogramTable &table);
+
+// Label building and Family::Add() happen here, at startup and when the topology changes only.
+// The returned tables are then reused by every collection cycle.
+// Stream tables also cover the Unassigned block.
+// Counters continue from their state in checkpoint.
+CounterTable bindPortMetrics(const NtStatistics_t &hStat, Family<Counter> &counter_family, Checkpoint &checkpoint,
+                             const int ports_count);
+CounterTable bindStreamMetrics(Family<Counter> &counter_family, Checkpoint &checkpoint, const std::vector<int> &stream_ids);
+HistogramTable bindPortHistograms(const NtStatistics_t &hStat, Family<Histogram> &histogram_family, const int ports_count);
+
+// Steady-state cycle: only stores values into pre-bound gauges, no allocations and no label hashing
+void processPortMetrics(const NtStatistics_t &hStat, const CounterTable &ports);
+void processStreamMetrics(const NtStatistics_t &hStat, const CounterTable &streams);
+void processPortHistograms(const NtStatistics_t &hStat, HistogramTable &histograms);
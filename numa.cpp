@@ -0,0 +1,114 @@
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "numa.h"
+#include "discovery.h"
+#include "metrics.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace prometheus;
+
+void openNumaAudit(NumaAudit &numa, Family<Gauge> &gauge_family)
+{
+    numa.gauge_family = &gauge_family;
+}
+
+// Node the kernel attached the adapter's PCI device to
+static int adapterNumaNode(const struct NtInfoAdapter_v6_s &adapter)
+{
+    char path[64];
+    int node = NUMA_NODE_UNKNOWN;
+
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%04x:%02x:%02x.%x/numa_node", adapter.busid.s.domain,
+             adapter.busid.s.bus, adapter.busid.s.device, adapter.busid.s.function);
+
+    FILE *file = fopen(path, "r");
+    if (file == nullptr)
+        return NUMA_NODE_UNKNOWN;
+    if (fscanf(file, "%d", &node) != 1)
+        node = NUMA_NODE_UNKNOWN;
+    fclose(file);
+
+    return node;
+}
+
+static bool readInfo(NtInfoStream_t hInfoStream, NtInfo_t &hInfo, const char *what, const int index)
+{
+    char errorBuffer[NT_ERRBUF_SIZE];
+    int status;
+
+    if ((status = NT_InfoRead(hInfoStream, &hInfo)) != NT_SUCCESS)
+    {
+        NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+        fprintf(stderr, "NT_InfoRead() %s %d failed: %s\n", what, index, errorBuffer);
+        return false;
+    }
+
+    return true;
+}
+
+static void setSeries(NumaAudit &numa, std::vector<Gauge *> &gauges, const Labels &labels, const double value)
+{
+    Gauge &gauge = numa.gauge_family->Add(labels);
+
+    gauge.Set(value);
+    gauges.push_back(&gauge);
+}
+
+void processNumaAudit(NumaAudit &numa, NtInfoStream_t hInfoStream, const Topology &topology)
+{
+    NtInfo_t hInfo;
+    std::vector<Gauge *> gauges;
+
+    for (int a = 0; a < topology.adapters_count; a++)
+    {
+        const std::string adapter = std::to_string(a);
+
+        hInfo.cmd = NT_INFO_CMD_READ_ADAPTER_V6;
+        hInfo.u.adapter_v6.adapterNo = static_cast<uint8_t>(a);
+        if (!readInfo(hInfoStream, hInfo, "adapter", a))
+            return;
+
+        const int adapter_node = adapterNumaNode(hInfo.u.adapter_v6.data);
+        const uint32_t host_buffers_count = hInfo.u.adapter_v6.data.numHostBuffersRx;
+
+        setSeries(numa, gauges, {{"numa", "adapter_node"}, {"adapter", adapter}}, adapter_node);
+
+        for (uint32_t h = 0; h < host_buffers_count; h++)
+        {
+            const Labels labels = {{"adapter", adapter}, {"host_buffer", std::to_string(h)}};
+
+            hInfo.cmd = NT_INFO_CMD_READ_HOSTBUFFER_V1;
+            hInfo.u.hostBuffer_v1.adapterNo = static_cast<uint8_t>(a);
+            hInfo.u.hostBuffer_v1.hostBufferNo = h;
+            hInfo.u.hostBuffer_v1.hostBufferType = NT_NET_HOSTBUFFER_TYPE_RX;
+            if (!readInfo(hInfoStream, hInfo, "host buffer", h))
+                return;
+
+            const int node = hInfo.u.hostBuffer_v1.data.numaNode;
+            Labels node_labels = labels;
+            Labels remote_labels = labels;
+            node_labels["numa"] = "host_buffer_node";
+            remote_labels["numa"] = "host_buffer_remote";
+            setSeries(numa, gauges, node_labels, node);
+            setSeries(numa, gauges, remote_labels, adapter_node != NUMA_NODE_UNKNOWN && node != adapter_node);
+        }
+    }
+
+    for (const int s : topology.stream_ids)
+    {
+        hInfo.cmd = NT_INFO_CMD_READ_STREAMID;
+        hInfo.u.streamID.streamId = s;
+        if (!readInfo(hInfoStream, hInfo, "stream ID", s))
+            return;
+
+        setSeries(numa, gauges, {{"numa", "stream_node"}, {"stream_id", std::to_string(s)}},
+                  hInfo.u.streamID.data.numaNode);
+    }
+
+    removeStaleMetrics(*numa.gauge_family, numa.gauges, gauges);
+    numa.gauges = gauges;
+}
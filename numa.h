@@ -0,0 +1,29 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "discovery.h"
+
+#include <vector>
+
+using namespace prometheus;
+
+// NUMA node reported when the node of an adapter is unknown
+const int NUMA_NODE_UNKNOWN = -1;
+
+// Placement of the adapters, their RX host buffers and the stream IDs, exported with the "numa" label:
+// "adapter_node", "host_buffer_node", "host_buffer_remote" (1 when the host buffer is on another node than its
+// adapter) and "stream_node"
+struct NumaAudit
+{
+    Family<Gauge> *gauge_family;
+    std::vector<Gauge *> gauges; // Series of the last audit
+};
+
+void openNumaAudit(NumaAudit &numa, Family<Gauge> &gauge_family);
+
+// Reads NT_INFO_CMD_READ_ADAPTER_V6, NT_INFO_CMD_READ_HOSTBUFFER_V1 and NT_INFO_CMD_READ_STREAMID for the topology.
+// The adapter node comes from the sysfs entry of its PCI bus ID. Series of the previous audit that are gone are
+// removed; a failed read keeps them.
+void processNumaAudit(NumaAudit &numa, NtInfoStream_t hInfoStream, const Topology &topology);
@@ -0,0 +1,199 @@
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "rates.h"
+#include "metrics.h"
+#include "timestamps.h"
+#include "window.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define RATES_AVX2
+#endif
+
+using namespace prometheus;
+
+static size_t addClock(RateEngine &engine, const NtStatistics_t &hStat, const size_t ts_offset, const size_t type_offset)
+{
+    const QueryResult &data = hStat.u.query_v3.data;
+    RateClock clock;
+
+    clock.ts_offset = ts_offset;
+    clock.type_offset = type_offset;
+    clock.previous_ts = counterAt(&data, ts_offset);
+    clock.previous = timestampToSeconds(clock.previous_ts, *reinterpret_cast<const enum NtTimestampType_e *>(
+                                                               reinterpret_cast<const char *>(&data) + type_offset));
+    clock.moved = false;
+    clock.inverse = 0;
+    engine.clocks.push_back(clock);
+
+    return engine.clocks.size() - 1;
+}
+
+size_t addPortClock(RateEngine &engine, const NtStatistics_t &hStat, const int port)
+{
+    const size_t base = offsetof(QueryResult, port.aPorts) + port * sizeof(struct NtStatGroupport_v2_s);
+
+    return addClock(engine, hStat, base + offsetof(struct NtStatGroupport_v2_s, ts),
+                    base + offsetof(struct NtStatGroupport_v2_s, tsType));
+}
+
+size_t addStreamClock(RateEngine &engine, const NtStatistics_t &hStat)
+{
+    // stream.ts has no type of its own, it follows the adapter TimestampFormat like the port time stamps
+    return addClock(engine, hStat, offsetof(QueryResult, stream.ts),
+                    offsetof(QueryResult, port.aPorts) + offsetof(struct NtStatGroupport_v2_s, tsType));
+}
+
+size_t addColorClock(RateEngine &engine, const NtStatistics_t &hStat, const int adapter)
+{
+    const size_t base = offsetof(QueryResult, adapter.aAdapters) + adapter * sizeof(struct NtStatGroupAdapter_s) +
+                        offsetof(struct NtStatGroupAdapter_s, color);
+
+    return addClock(engine, hStat, base + offsetof(struct NtStatGroupColor_s, ts),
+                    base + offsetof(struct NtStatGroupColor_s, tsType));
+}
+
+size_t addRate(RateEngine &engine, const NtStatistics_t &hStat, const size_t offset, const size_t clock, Gauge *gauge,
+               const size_t window)
+{
+    const uint64_t value = counterAt(&hStat.u.query_v3.data, offset);
+
+    engine.offsets.push_back(offset);
+    engine.clock_of.push_back(clock);
+    engine.current.push_back(value);
+    engine.previous.push_back(value);
+    engine.inverse.push_back(0);
+    engine.rates.push_back(0);
+    engine.gauges.push_back(gauge);
+    engine.windows.push_back(window);
+
+    return engine.offsets.size() - 1;
+}
+
+const char *rateType(const char *count_type)
+{
+    return std::strcmp(count_type, "bytes_count") == 0 ? "bytes_rate" : "pkts_rate";
+}
+
+void computeRatesScalar(const uint64_t *current, uint64_t *previous, const double *inverse, double *rates,
+                        const size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        rates[i] = counterDelta(current[i], previous[i]) * inverse[i];
+    }
+}
+
+#ifdef RATES_AVX2
+// Exact uint64_t to double without AVX-512: the high and low 32 bits are placed in the mantissas of 2^84 and 2^52
+__attribute__((target("avx2"))) static inline __m256d uint64ToDouble(const __m256i x)
+{
+    const __m256i high =
+        _mm256_or_si256(_mm256_srli_epi64(x, 32), _mm256_castpd_si256(_mm256_set1_pd(19342813113834066795298816.)));
+    const __m256i low = _mm256_blend_epi16(x, _mm256_castpd_si256(_mm256_set1_pd(4503599627370496.)), 0xcc);
+    const __m256d high_value = _mm256_sub_pd(_mm256_castsi256_pd(high), _mm256_set1_pd(19342813118337666422669312.));
+
+    return _mm256_add_pd(high_value, _mm256_castsi256_pd(low));
+}
+
+__attribute__((target("avx2"))) static void ratesAvx2(const uint64_t *current, uint64_t *previous,
+                                                      const double *inverse, double *rates, const size_t count)
+{
+    // Flipping the sign bit turns the signed 64-bit compare into an unsigned one
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m256i now = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(current + i));
+        const __m256i before = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(previous + i));
+        const __m256i cleared = _mm256_cmpgt_epi64(_mm256_xor_si256(before, sign), _mm256_xor_si256(now, sign));
+        const __m256i delta = _mm256_blendv_epi8(_mm256_sub_epi64(now, before), now, cleared);
+
+        _mm256_storeu_pd(rates + i, _mm256_mul_pd(uint64ToDouble(delta), _mm256_loadu_pd(inverse + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(previous + i), now);
+    }
+
+    computeRatesScalar(current + i, previous + i, inverse + i, rates + i, count - i);
+}
+#endif
+
+bool computeRatesAvx2(const uint64_t *current, uint64_t *previous, const double *inverse, double *rates,
+                      const size_t count)
+{
+#ifdef RATES_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+
+    if (avx2)
+    {
+        ratesAvx2(current, previous, inverse, rates, count);
+        return true;
+    }
+#endif
+    return false;
+}
+
+void computeRates(const uint64_t *current, uint64_t *previous, const double *inverse, double *rates, const size_t count)
+{
+    if (!computeRatesAvx2(current, previous, inverse, rates, count))
+        computeRatesScalar(current, previous, inverse, rates, count);
+}
+
+void processRates(RateEngine &engine, const NtStatistics_t &hStat, WindowAggregator *windows, const double interval)
+{
+    const QueryResult &data = hStat.u.query_v3.data;
+
+    for (RateClock &clock : engine.clocks)
+    {
+        const uint64_t ts = counterAt(&data, clock.ts_offset);
+
+        // No time stamp at all, fall back on the read interval
+        if (ts == 0)
+        {
+            clock.moved = true;
+            clock.inverse = interval > 0 ? 1 / interval : 0;
+            continue;
+        }
+
+        clock.moved = ts != clock.previous_ts;
+        clock.inverse = 0;
+        if (!clock.moved)
+            continue;
+
+        // A time stamp going backwards means the adapter clock was set, the sample only reseeds the counters
+        const double seconds = timestampToSeconds(ts, *reinterpret_cast<const enum NtTimestampType_e *>(
+                                                          reinterpret_cast<const char *>(&data) + clock.type_offset));
+        if (seconds > clock.previous)
+            clock.inverse = 1 / (seconds - clock.previous);
+        clock.previous_ts = ts;
+        clock.previous = seconds;
+    }
+
+    // Counters of clocks without a new sample keep their previous value
+    const size_t count = engine.offsets.size();
+    for (size_t i = 0; i < count; i++)
+    {
+        const RateClock &clock = engine.clocks[engine.clock_of[i]];
+
+        engine.inverse[i] = clock.inverse;
+        engine.current[i] = clock.moved ? counterAt(&data, engine.offsets[i]) : engine.previous[i];
+    }
+
+    computeRates(engine.current.data(), engine.previous.data(), engine.inverse.data(), engine.rates.data(), count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (engine.inverse[i] == 0 || engine.gauges[i] == nullptr)
+            continue;
+
+        engine.gauges[i]->Set(engine.rates[i]);
+        if (windows != nullptr && engine.windows[i] != NO_WINDOW)
+            observeWindow(*windows, engine.windows[i], engine.rates[i]);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "window.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace prometheus;
+
+// Hardware time stamp a group of counters is sampled with
+struct RateClock
+{
+    size_t ts_offset;   // Offset of the uint64_t time stamp inside QueryResult
+    size_t type_offset; // Offset of its NtTimestampType_e inside QueryResult
+    uint64_t previous_ts;
+    double previous;    // Seconds
+    bool moved;         // A new sample was taken since the previous read
+    double inverse;     // 1 / seconds since that sample, 0 when the time stamp went backwards
+};
+
+// Per-second rates of many counters, taken between the hardware time stamps of their clocks.
+// Values are gathered into contiguous uint64_t arrays so computeRates() runs over all of them at once.
+// Series whose clock has no new sample since the previous read are left untouched.
+struct RateEngine
+{
+    std::vector<RateClock> clocks;
+    std::vector<size_t> offsets;  // Counter offsets inside QueryResult
+    std::vector<size_t> clock_of; // Clock index of each counter
+    std::vector<uint64_t> current;
+    std::vector<uint64_t> previous;
+    std::vector<double> inverse; // Inverse of the clock of each counter
+    std::vector<double> rates;
+    std::vector<Gauge *> gauges; // nullptr while a series isn't exported
+    std::vector<size_t> windows; // WindowAggregator slots, NO_WINDOW for none
+};
+
+// Time stamps of a port, the stream block and an adapter's color block
+size_t addPortClock(RateEngine &engine, const NtStatistics_t &hStat, const int port);
+size_t addStreamClock(RateEngine &engine, const NtStatistics_t &hStat);
+size_t addColorClock(RateEngine &engine, const NtStatistics_t &hStat, const int adapter);
+
+// Adds a counter sampled with clock, using hStat as its first sample. Returns its index.
+size_t addRate(RateEngine &engine, const NtStatistics_t &hStat, const size_t offset, const size_t clock, Gauge *gauge,
+               const size_t window);
+
+// Rates of every counter from hStat. interval, in seconds, stands in for clocks without time stamps.
+// windows may be nullptr when no series has window companions.
+void processRates(RateEngine &engine, const NtStatistics_t &hStat, WindowAggregator *windows, const double interval);
+
+// rates[i] = (current[i] - previous[i]) * inverse[i], a counter going backwards counts from zero; previous = current.
+// Uses AVX2 where the CPU has it.
+void computeRates(const uint64_t *current, uint64_t *previous, const double *inverse, double *rates, const size_t count);
+
+// The two paths of computeRates(), for tests/rates_bench.cpp. computeRatesAvx2() returns false, leaving the arrays
+// untouched, where the build or the CPU has no AVX2.
+void computeRatesScalar(const uint64_t *current, uint64_t *previous, const double *inverse, double *rates,
+                        const size_t count);
+bool computeRatesAvx2(const uint64_t *current, uint64_t *previous, const double *inverse, double *rates,
+                      const size_t count);
+
+// Type label of the rate of a "pkts_count" or "bytes_count" series
+const char *rateType(const char *count_type);
@@ -0,0 +1,208 @@
+#include <prometheus/registry.h>
+#include <prometheus/counter.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "rollup.h"
+#include "continuity.h"
+#include "metrics.h"
+#include "rates.h"
+#include "window.h"
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace prometheus;
+
+#define ROLLUP_PORT_COUNTER(group, field, type, name) \
+    { offsetof(struct NtPortStatistics_v2_s, group.field), type, name, offsetof(struct NtPortStatistics_v2_s, valid.group) }
+
+#define ROLLUP_STREAM_COUNTER(block, field, type, name) \
+    { offsetof(struct NtStatGroupStream_s, streamid[0].block.field), type, name, ALWAYS_VALID }
+
+// Throughput and drops of each port direction, summed per adapter and host
+static const CounterDescriptor ROLLUP_PORT_COUNTERS[] = {
+    ROLLUP_PORT_COUNTER(RMON1, pkts, "pkts_count", "total"),
+    ROLLUP_PORT_COUNTER(RMON1, octets, "bytes_count", "total"),
+    ROLLUP_PORT_COUNTER(RMON1, dropEvents, "pkts_count", "drop"),
+    ROLLUP_PORT_COUNTER(extDrop, pktsMacBandwidth, "pkts_count", "drop_mac_bandwidth"),
+    ROLLUP_PORT_COUNTER(extDrop, pktsOverflow, "pkts_count", "drop_overflow"),
+    ROLLUP_PORT_COUNTER(extDrop, octetsOverflow, "bytes_count", "drop_overflow"),
+};
+
+// Stream counters cover all adapters, they are summed per host only, with stream_id="all"
+static const CounterDescriptor ROLLUP_STREAM_COUNTERS[] = {
+    ROLLUP_STREAM_COUNTER(forward, pkts, "pkts_count", "forward"),
+    ROLLUP_STREAM_COUNTER(forward, octets, "bytes_count", "forward"),
+    ROLLUP_STREAM_COUNTER(drop, pkts, "pkts_count", "drop"),
+    ROLLUP_STREAM_COUNTER(drop, octets, "bytes_count", "drop"),
+};
+
+// Returns the series with these labels, adding it on first use
+static size_t rollupSeries(RollupTable &rollups, std::map<Labels, size_t> &bound, Family<Counter> &counter_family,
+                           Family<Gauge> &gauge_family, Checkpoint &checkpoint, const CounterDescriptor &counter,
+                           Labels labels, const int adapter)
+{
+    labels[counter.type] = counter.name;
+    if (adapter >= 0)
+    {
+        labels["rollup"] = "adapter";
+        labels["adapter"] = std::to_string(adapter);
+    }
+    else
+    {
+        labels["rollup"] = "host";
+    }
+
+    const auto found = bound.find(labels);
+    if (found != bound.end())
+        return found->second;
+
+    RollupSeries series = {};
+    series.counter = &addContinuousCounter(counter_family, checkpoint, labels, series.state);
+
+    Labels rate_labels = labels;
+    rate_labels.erase(counter.type);
+    rate_labels[rateType(counter.type)] = counter.name;
+    series.rate = &gauge_family.Add(rate_labels);
+
+    rollups.series.push_back(series);
+    return bound[labels] = rollups.series.size() - 1;
+}
+
+static void addMember(RollupTable &rollups, const NtStatistics_t &hStat, const size_t offset, const size_t clock,
+                      const CounterState *state, const size_t adapter_series, const size_t host_series)
+{
+    addRate(rollups.rates, hStat, offset, clock, nullptr, NO_WINDOW);
+    rollups.states.push_back(state);
+    rollups.adapter_series.push_back(adapter_series);
+    rollups.host_series.push_back(host_series);
+}
+
+// Sums the member totals and held rates into their series
+static void sumMembers(RollupTable &rollups)
+{
+    for (RollupSeries &series : rollups.series)
+    {
+        series.sum = 0;
+        series.rate_sum = 0;
+    }
+
+    for (size_t i = 0; i < rollups.states.size(); i++)
+    {
+        RollupSeries &host = rollups.series[rollups.host_series[i]];
+        host.sum += rollups.states[i]->total;
+        host.rate_sum += rollups.held[i];
+
+        if (rollups.adapter_series[i] == NO_ROLLUP)
+            continue;
+
+        RollupSeries &adapter = rollups.series[rollups.adapter_series[i]];
+        adapter.sum += rollups.states[i]->total;
+        adapter.rate_sum += rollups.held[i];
+    }
+}
+
+RollupTable bindRollupMetrics(const NtStatistics_t &hStat, Family<Counter> &counter_family, Family<Gauge> &gauge_family,
+                              Checkpoint &checkpoint, const CounterTable &port_counters,
+                              const CounterTable &stream_counters, const int ports_count,
+                              const std::vector<int> &port_adapters, const std::vector<int> &stream_ids)
+{
+    std::map<size_t, const CounterState *> states; // Offset -> state of the bound counters
+    std::map<Labels, size_t> bound;
+    RollupTable rollups;
+
+    for (const BoundCounter &counter : port_counters.counters)
+        states[counter.offset] = counter.state;
+    for (const BoundCounter &counter : stream_counters.counters)
+        states[counter.offset] = counter.state;
+
+    // Ports whose adapter is unknown only count for the host
+    for (int p = 0; p < ports_count; p++)
+    {
+        const int adapter = p < static_cast<int>(port_adapters.size()) ? port_adapters[p] : -1;
+        const size_t clock = addPortClock(rollups.rates, hStat, p);
+
+        for (size_t d = 0; d < PORT_DIRECTIONS_COUNT; d++)
+        {
+            for (const CounterDescriptor &counter : ROLLUP_PORT_COUNTERS)
+            {
+                const size_t offset = portOffset(p, d) + counter.offset;
+                const auto state = states.find(offset);
+                if (state == states.end())
+                    continue;
+
+                const Labels direction = {{"direction", PORT_DIRECTIONS[d].name}};
+                addMember(rollups, hStat, offset, clock, state->second,
+                          adapter >= 0 ? rollupSeries(rollups, bound, counter_family, gauge_family, checkpoint,
+                                                      counter, direction, adapter)
+                                       : NO_ROLLUP,
+                          rollupSeries(rollups, bound, counter_family, gauge_family, checkpoint, counter, direction, -1));
+            }
+        }
+    }
+
+    // The Unassigned block isn't forwarded to nor dropped by any stream, it stays out of the stream rollups
+    const size_t stream_clock = addStreamClock(rollups.rates, hStat);
+    for (const int s : stream_ids)
+    {
+        for (const CounterDescriptor &counter : ROLLUP_STREAM_COUNTERS)
+        {
+            const size_t offset = streamOffset(s) + counter.offset;
+            const auto state = states.find(offset);
+            if (state == states.end())
+                continue;
+
+            addMember(rollups, hStat, offset, stream_clock, state->second, NO_ROLLUP,
+                      rollupSeries(rollups, bound, counter_family, gauge_family, checkpoint, counter,
+                                   {{"stream_id", "all"}}, -1));
+        }
+    }
+
+    // Counting starts from the members as bound, so ports or streams joining or leaving don't move the rollups
+    rollups.held.assign(rollups.states.size(), 0.0);
+    sumMembers(rollups);
+    for (RollupSeries &series : rollups.series)
+        series.state->previous = series.sum;
+
+    return rollups;
+}
+
+std::vector<Counter *> tableCounters(const RollupTable &table)
+{
+    std::vector<Counter *> counters;
+
+    for (const RollupSeries &series : table.series)
+        counters.push_back(series.counter);
+
+    return counters;
+}
+
+std::vector<Gauge *> tableGauges(const RollupTable &table)
+{
+    std::vector<Gauge *> gauges;
+
+    for (const RollupSeries &series : table.series)
+        gauges.push_back(series.rate);
+
+    return gauges;
+}
+
+void processRollupMetrics(const NtStatistics_t &hStat, RollupTable &rollups, const double interval)
+{
+    processRates(rollups.rates, hStat, nullptr, interval);
+
+    for (size_t i = 0; i < rollups.states.size(); i++)
+    {
+        if (rollups.rates.inverse[i] != 0)
+            rollups.held[i] = rollups.rates.rates[i];
+    }
+
+    sumMembers(rollups);
+    for (RollupSeries &series : rollups.series)
+    {
+        advanceCounter(*series.counter, *series.state, series.sum);
+        series.rate->Set(series.rate_sum);
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/counter.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "metrics.h"
+#include "rates.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace prometheus;
+
+// A series summing member counters: with rollup="adapter" and the adapter label, or rollup="host".
+// Stream rollups also carry stream_id="all".
+struct RollupSeries
+{
+    Counter *counter;
+    CounterState *state; // previous holds the sum of the member totals at the last advance
+    Gauge *rate;
+    uint64_t sum;        // Preallocated sums of the cycle
+    double rate_sum;
+};
+
+// No rollup series at this level
+const size_t NO_ROLLUP = static_cast<size_t>(-1);
+
+// Adapter and host totals of port throughput and drops, and host totals of stream forward and drop, summed from the
+// counter states and rates of the same QUERY_V3 read so every rollup is consistent within one sample.
+// Ports map to adapters with the adapterNo of their port info.
+struct RollupTable
+{
+    RateEngine rates;                         // One per member, no gauges, rates are summed per series
+    std::vector<const CounterState *> states; // Member counter series, owned by the Checkpoint
+    std::vector<size_t> adapter_series;       // Adapter series of each member, NO_ROLLUP for stream members
+    std::vector<size_t> host_series;          // Host series of each member
+    std::vector<double> held;                 // Last rate of each member, kept while its group has no new sample
+    std::vector<RollupSeries> series;
+};
+
+// Binds the members among the counters of port_counters and stream_counters, which must have been bound from the
+// same topology. Rollup counters continue from their state in checkpoint.
+RollupTable bindRollupMetrics(const NtStatistics_t &hStat, Family<Counter> &counter_family, Family<Gauge> &gauge_family,
+                              Checkpoint &checkpoint, const CounterTable &port_counters,
+                              const CounterTable &stream_counters, const int ports_count,
+                              const std::vector<int> &port_adapters, const std::vector<int> &stream_ids);
+
+std::vector<Counter *> tableCounters(const RollupTable &table);
+std::vector<Gauge *> tableGauges(const RollupTable &table);
+
+// Runs after processPortMetrics() and processStreamMetrics() of the same read.
+// interval, in seconds, stands in for groups without time stamps.
+void processRollupMetrics(const NtStatistics_t &hStat, RollupTable &rollups, const double interval);
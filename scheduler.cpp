@@ -0,0 +1,178 @@
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+
+#if defined(__linux__) || defined(__FreeBSD__)
+#include <time.h> // clock_nanosleep()
+#endif
+
+using namespace prometheus;
+
+void openScheduler(Scheduler &scheduler, Family<Gauge> &gauge_family, const char *collector, const int period_ms,
+                   const int phase_ms)
+{
+    scheduler.collector = collector;
+    scheduler.period = std::chrono::milliseconds(period_ms);
+    scheduler.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(phase_ms);
+    scheduler.overruns = 0;
+    scheduler.skipped = 0;
+    scheduler.period_gauge = &gauge_family.Add({{"scheduler", "period_seconds"}, {"collector", collector}});
+    scheduler.cycle_gauge = &gauge_family.Add({{"scheduler", "cycle_seconds"}, {"collector", collector}});
+    scheduler.overruns_gauge = &gauge_family.Add({{"scheduler", "overruns"}, {"collector", collector}});
+    scheduler.skipped_gauge = &gauge_family.Add({{"scheduler", "skipped_ticks"}, {"collector", collector}});
+
+    scheduler.period_gauge->Set(std::chrono::duration<double>(scheduler.period).count());
+}
+
+void setSchedulerPeriod(Scheduler &scheduler, const std::chrono::nanoseconds period)
+{
+    if (period == scheduler.period)
+        return;
+
+    scheduler.period = period;
+    scheduler.period_gauge->Set(std::chrono::duration<double>(period).count());
+}
+
+static void sleepSliceUntil(const std::chrono::steady_clock::time_point deadline)
+{
+#if defined(__linux__) || defined(__FreeBSD__)
+    // steady_clock is CLOCK_MONOTONIC, an absolute deadline doesn't accumulate wake-up latency
+    const auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    struct timespec ts;
+    ts.tv_sec = since_epoch / 1000000000;
+    ts.tv_nsec = since_epoch % 1000000000;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+#else
+    std::this_thread::sleep_until(deadline);
+#endif
+}
+
+static void sleepUntil(const std::chrono::steady_clock::time_point deadline, const volatile sig_atomic_t &stop_flag)
+{
+    // Sleep in slices, signals only interrupt the sleep of the thread they are delivered to
+    while (stop_flag != 1 && std::chrono::steady_clock::now() < deadline)
+        sleepSliceUntil(std::min(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(SYNC_WAIT_MS)));
+}
+
+void waitNextTick(Scheduler &scheduler, const volatile sig_atomic_t &stop_flag)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    scheduler.cycle_gauge->Set(std::chrono::duration<double>(now - scheduler.deadline).count());
+    scheduler.deadline += scheduler.period;
+
+    if (now >= scheduler.deadline)
+    {
+        const auto missed = (now - scheduler.deadline) / scheduler.period + 1;
+
+        scheduler.overruns++;
+        scheduler.skipped += missed;
+        scheduler.deadline += missed * scheduler.period;
+        scheduler.overruns_gauge->Set(scheduler.overruns);
+        scheduler.skipped_gauge->Set(scheduler.skipped);
+    }
+
+    sleepUntil(scheduler.deadline, stop_flag);
+}
+
+static void runTierLoop(Scheduler &scheduler, std::function<void()> collect, const volatile sig_atomic_t &stop_flag)
+{
+    sleepUntil(scheduler.deadline, stop_flag);
+
+    while (stop_flag != 1)
+    {
+        collect();
+        waitNextTick(scheduler, stop_flag);
+    }
+}
+
+std::thread runTier(Scheduler &scheduler, std::function<void()> collect, const volatile sig_atomic_t &stop_flag)
+{
+    return std::thread(runTierLoop, std::ref(scheduler), collect, std::cref(stop_flag));
+}
+
+void openSyncReader(SyncReader &reader, NtStatStream_t hStatStream, Family<Gauge> &gauge_family)
+{
+    reader.hStatStream = hStatStream;
+    reader.hStat.reset(new NtStatistics_t());
+    reader.last_update = std::chrono::steady_clock::now();
+    reader.stalled = false;
+    reader.stalls = 0;
+    reader.stalls_gauge = &gauge_family.Add({{"scheduler", "sync_stalls"}});
+}
+
+// Holds its own reference to the buffer, which outlives the reader when the read is abandoned
+static int readUpdate(NtStatStream_t hStatStream, std::shared_ptr<NtStatistics_t> hStat)
+{
+    hStat->cmd = NT_STATISTICS_READ_CMD_QUERY_V3;
+    hStat->u.query_v3.poll = 0;  // Wait for a new set
+    hStat->u.query_v3.clear = 0; // Do not clear statistics
+
+    return NT_StatRead(hStatStream, hStat);
+}
+
+static void checkStall(SyncReader &reader)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    if (!reader.stalled && now - reader.last_update >= std::chrono::milliseconds(SYNC_STALL_MS))
+    {
+        fprintf(stderr, "No statistics update from ntservice for %d s\n", SYNC_STALL_MS / 1000);
+        reader.stalled = true;
+        reader.stalls_gauge->Set(++reader.stalls);
+    }
+}
+
+int readNextUpdate(SyncReader &reader, NtStatistics_t &hStat)
+{
+    if (!reader.pending.valid())
+    {
+        // Unlike the one of std::async, the future of a packaged task doesn't block on destruction
+        std::packaged_task<int()> read(std::bind(readUpdate, reader.hStatStream, reader.hStat));
+        reader.pending = read.get_future();
+        std::thread(std::move(read)).detach();
+    }
+
+    if (reader.pending.wait_for(std::chrono::milliseconds(SYNC_WAIT_MS)) != std::future_status::ready)
+    {
+        checkStall(reader);
+        return NT_STATUS_TIMEOUT;
+    }
+
+    const int status = reader.pending.get();
+
+    // ntservice gave up its own wait or is being reconfigured, the next call asks again
+    if (status == NT_STATUS_TIMEOUT || status == NT_STATUS_TRYAGAIN)
+    {
+        checkStall(reader);
+        return NT_STATUS_TIMEOUT;
+    }
+
+    if (status == NT_SUCCESS)
+    {
+        hStat = *reader.hStat;
+        reader.last_update = std::chrono::steady_clock::now();
+        reader.stalled = false;
+    }
+    return status;
+}
+
+bool closeSyncReader(SyncReader &reader)
+{
+    if (!reader.pending.valid() ||
+        reader.pending.wait_for(std::chrono::milliseconds(SYNC_CLOSE_WAIT_MS)) == std::future_status::ready)
+        return true;
+
+    fprintf(stderr, "Statistics read still pending after %d ms, leaving it to the process exit\n", SYNC_CLOSE_WAIT_MS);
+    return false;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+
+using namespace prometheus;
+
+// Shortest collection period accepted
+const int SCHEDULER_MIN_PERIOD_MS = 100;
+
+// Longest single sleep of waitNextTick() and readNextUpdate(), bounds how late a stop signal is noticed
+const int SYNC_WAIT_MS = 200;
+
+// Time without a fresh counter set after which synchronized reads count a stall
+const int SYNC_STALL_MS = 10000;
+
+// Longest wait of closeSyncReader() for the pending read
+const int SYNC_CLOSE_WAIT_MS = 2000;
+
+// Fixed-rate ticks on the monotonic clock. Deadlines advance by whole periods from the first tick,
+// so collection cost never shifts the period; ticks that have already passed are skipped, not run late.
+struct Scheduler
+{
+    const char *collector; // "collector" label of the scheduler series
+    std::chrono::nanoseconds period;
+    std::chrono::steady_clock::time_point deadline; // Start of the current tick
+    uint64_t overruns;                              // Cycles that ran past the next tick
+    uint64_t skipped;                               // Ticks dropped by those cycles
+    Gauge *period_gauge;
+    Gauge *cycle_gauge;    // Duration of the last cycle, in seconds
+    Gauge *overruns_gauge;
+    Gauge *skipped_gauge;
+};
+
+// The first tick comes phase_ms from now, so tiers with related periods don't all fire at once
+void openScheduler(Scheduler &scheduler, Family<Gauge> &gauge_family, const char *collector, const int period_ms,
+                   const int phase_ms);
+
+// Takes effect from the next tick on, the current one keeps its deadline
+void setSchedulerPeriod(Scheduler &scheduler, const std::chrono::nanoseconds period);
+
+// Records the cycle that just finished and sleeps until the next tick. Returns early once stop_flag is set.
+void waitNextTick(Scheduler &scheduler, const volatile sig_atomic_t &stop_flag);
+
+// Runs collect on its own thread at every tick of scheduler until stop_flag is set,
+// so a slow tier never holds up a faster one
+std::thread runTier(Scheduler &scheduler, std::function<void()> collect, const volatile sig_atomic_t &stop_flag);
+
+// Reads paced by ntservice instead of a timer: every NT_StatRead(poll = 0) returns the next counter set exactly once.
+// The blocking read runs on a detached helper thread into a buffer it shares, so the caller can stop waiting, or give
+// the read up altogether, without racing it.
+struct SyncReader
+{
+    NtStatStream_t hStatStream;
+    std::shared_ptr<NtStatistics_t> hStat; // Written by the pending read only
+    std::future<int> pending;
+    std::chrono::steady_clock::time_point last_update;
+    bool stalled;
+    uint64_t stalls; // Times no counter set arrived for SYNC_STALL_MS
+    Gauge *stalls_gauge;
+};
+
+void openSyncReader(SyncReader &reader, NtStatStream_t hStatStream, Family<Gauge> &gauge_family);
+
+// Waits up to SYNC_WAIT_MS for the next QUERY_V3 set and copies it to hStat.
+// Returns NT_STATUS_TIMEOUT when none arrived yet, the read then stays pending for the next call.
+int readNextUpdate(SyncReader &reader, NtStatistics_t &hStat);
+
+// Waits up to SYNC_CLOSE_WAIT_MS for the pending read, so shutdown doesn't hang when ntservice stopped publishing.
+// Returns false when the read is still blocked inside NTAPI: it is abandoned to the process exit, and the caller must
+// then neither close the stat stream nor call NT_Done() under it.
+bool closeSyncReader(SyncReader &reader);
@@ -0,0 +1,91 @@
+// Checks that a steady-state collection cycle does no heap allocation.
+// Build and run from the repository root:
+//   gcc -g tests/alloc_test.cpp metrics.cpp continuity.cpp -o alloc_test -std=c++11 -pthread -I. -Iinclude -Llib
+//       -lstdc++ -lprometheus-cpp-core
+//   ./alloc_test
+
+#include <prometheus/registry.h>
+#include <prometheus/counter.h>
+#include <napatech/nt.h>
+#include "metrics.h"
+#include "continuity.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+using namespace prometheus;
+
+static void sigproc_(int) noexcept {}
+
+static std::atomic<size_t> allocations_(0);
+
+void *operator new(size_t size)
+{
+    allocations_++;
+    if (void *memory = std::malloc(size))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept
+{
+    std::free(memory);
+}
+
+int main()
+{
+    const int ports_count = 4;
+    const std::vector<int> stream_ids = {0, 3, 17};
+
+    Registry registry;
+    auto &counter_family = BuildCounter().Name("napatech_stat_total").Help("").Register(registry);
+    Checkpoint checkpoint;
+
+    std::unique_ptr<NtStatistics_t> hStat(new NtStatistics_t());
+    QueryResult &data = hStat->u.query_v3.data;
+    for (int p = 0; p < ports_count; p++)
+    {
+        data.port.aPorts[p].rx.valid.RMON1 = 1;
+        data.port.aPorts[p].rx.valid.extDrop = 1;
+        data.port.aPorts[p].tx.valid.RMON1 = 1;
+    }
+
+    const CounterTable ports = bindPortMetrics(*hStat, counter_family, checkpoint, ports_count);
+    const CounterTable streams = bindStreamMetrics(counter_family, checkpoint, stream_ids);
+
+    size_t allocations = 0;
+    for (int cycle = 1; cycle <= 100; cycle++)
+    {
+        for (int p = 0; p < ports_count; p++)
+        {
+            data.port.aPorts[p].rx.RMON1.pkts = cycle * 1000;
+            data.port.aPorts[p].rx.extDrop.pktsOverflow = cycle;
+        }
+        for (const int s : stream_ids)
+            data.stream.streamid[s].forward.pkts = cycle * 500;
+
+        const size_t before = allocations_;
+        processPortMetrics(*hStat, ports);
+        processStreamMetrics(*hStat, streams);
+        allocations += allocations_ - before;
+    }
+
+    if (allocations != 0)
+    {
+        fprintf(stderr, "FAIL: %zu allocations over 100 steady-state cycles\n", allocations);
+        return 1;
+    }
+    if (ports.counters.empty() || streams.counters.empty() || ports.counters[0].counter->Value() != 100000)
+    {
+        fprintf(stderr, "FAIL: counters were not advanced\n");
+        return 1;
+    }
+
+    printf("OK: %zu port and %zu stream series, no allocation over 100 cycles\n", ports.counters.size(),
+           streams.counters.size());
+    return 0;
+}
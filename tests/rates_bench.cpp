@@ -0,0 +1,119 @@
+// Cost of computeRates() per thousand series on the AVX2 and scalar paths, and a check that both give the same rates.
+// Build and run from the repository root:
+//   gcc -O2 tests/rates_bench.cpp rates.cpp timestamps.cpp window.cpp -o rates_bench -std=c++11 -pthread -I. -Iinclude
+//       -Llib -lstdc++ -lprometheus-cpp-core
+//   ./rates_bench
+
+#include "rates.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Counters advance by up to 2^40 per sample, every 16th one is cleared
+static void nextSample(std::mt19937_64 &random, std::vector<uint64_t> &current)
+{
+    for (size_t i = 0; i < current.size(); i++)
+    {
+        if (i % 16 == 15)
+            current[i] = random() >> 40;
+        else
+            current[i] += random() >> 24;
+    }
+}
+
+typedef void (*RatesPath)(const uint64_t *, uint64_t *, const double *, double *, const size_t);
+
+static void scalarPath(const uint64_t *current, uint64_t *previous, const double *inverse, double *rates,
+                       const size_t count)
+{
+    computeRatesScalar(current, previous, inverse, rates, count);
+}
+
+static void avx2Path(const uint64_t *current, uint64_t *previous, const double *inverse, double *rates,
+                     const size_t count)
+{
+    computeRatesAvx2(current, previous, inverse, rates, count);
+}
+
+// Nanoseconds per call, over rounds calls
+static double timePath(RatesPath path, const std::vector<uint64_t> &current, std::vector<uint64_t> previous,
+                       const std::vector<double> &inverse, std::vector<double> &rates, const int rounds)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int r = 0; r < rounds; r++)
+        path(current.data(), previous.data(), inverse.data(), rates.data(), current.size());
+
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+}
+
+static bool run(const size_t count, const bool avx2)
+{
+    std::mt19937_64 random(count);
+    std::vector<uint64_t> previous(count);
+    std::vector<double> inverse(count);
+
+    // A third of the counters start near 2^64, so deltas cover the whole uint64_t range
+    for (size_t i = 0; i < count; i++)
+    {
+        previous[i] = i % 3 == 0 ? UINT64_MAX - (random() >> 20) : random() >> 8;
+        inverse[i] = i % 7 == 0 ? 0 : 1.0 / (1 + i % 10);
+    }
+
+    std::vector<uint64_t> current = previous;
+    nextSample(random, current);
+
+    std::vector<uint64_t> scalar_previous = previous;
+    std::vector<uint64_t> avx2_previous = previous;
+    std::vector<double> scalar_rates(count);
+    std::vector<double> avx2_rates(count);
+
+    computeRatesScalar(current.data(), scalar_previous.data(), inverse.data(), scalar_rates.data(), count);
+    if (avx2)
+    {
+        computeRatesAvx2(current.data(), avx2_previous.data(), inverse.data(), avx2_rates.data(), count);
+        if (std::memcmp(scalar_rates.data(), avx2_rates.data(), count * sizeof(double)) != 0 ||
+            scalar_previous != avx2_previous)
+        {
+            fprintf(stderr, "FAIL: AVX2 and scalar rates differ over %zu series\n", count);
+            return false;
+        }
+    }
+
+    const int rounds = static_cast<int>(20000000 / count);
+    const double scalar_ns = timePath(scalarPath, current, previous, inverse, scalar_rates, rounds);
+    printf("%6zu series  scalar %8.1f ns/1000", count, scalar_ns * 1000 / count);
+    if (avx2)
+    {
+        const double avx2_ns = timePath(avx2Path, current, previous, inverse, avx2_rates, rounds);
+        printf("  avx2 %8.1f ns/1000  speedup %.2fx", avx2_ns * 1000 / count, scalar_ns / avx2_ns);
+    }
+    printf("\n");
+
+    return true;
+}
+
+int main()
+{
+    double probe_rate = 0;
+    uint64_t probe_previous = 0;
+    const uint64_t probe_current = 0;
+    const double probe_inverse = 0;
+    const bool avx2 = computeRatesAvx2(&probe_current, &probe_previous, &probe_inverse, &probe_rate, 1);
+
+    if (!avx2)
+        printf("No AVX2 on this build or CPU, timing the scalar path only\n");
+
+    // 1003 also runs the scalar tail of the AVX2 path
+    for (const size_t count : {1000, 1003, 10000})
+    {
+        if (!run(count, avx2))
+            return 1;
+    }
+
+    return 0;
+}
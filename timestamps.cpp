@@ -0,0 +1,202 @@
+#include <prometheus/collectable.h>
+#include <prometheus/metric_family.h>
+#include <prometheus/registry.h>
+#include <napatech/nt.h>
+#include "metrics.h"
+#include "timestamps.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace prometheus;
+
+// Milliseconds between January 1, 1601 and January 1, 1970
+static const int64_t NDIS_EPOCH_OFFSET_MS = 11644473600000LL;
+
+int64_t timestampToUnixMs(const uint64_t ts, const enum NtTimestampType_e type)
+{
+    switch (type)
+    {
+    case NT_TIMESTAMP_TYPE_NATIVE_UNIX:
+        return static_cast<int64_t>(ts / 100000);
+    case NT_TIMESTAMP_TYPE_NATIVE_NDIS:
+        return static_cast<int64_t>(ts / 100000) - NDIS_EPOCH_OFFSET_MS;
+    case NT_TIMESTAMP_TYPE_NDIS: // 100 ns resolution
+        return static_cast<int64_t>(ts / 10000) - NDIS_EPOCH_OFFSET_MS;
+    case NT_TIMESTAMP_TYPE_PCAP: // Seconds in the lower 32 bits, microseconds in the upper
+        return static_cast<int64_t>(ts & 0xffffffff) * 1000 + static_cast<int64_t>(ts >> 32) / 1000;
+    case NT_TIMESTAMP_TYPE_PCAP_NANOTIME: // Seconds in the lower 32 bits, nanoseconds in the upper
+        return static_cast<int64_t>(ts & 0xffffffff) * 1000 + static_cast<int64_t>(ts >> 32) / 1000000;
+    case NT_TIMESTAMP_TYPE_UNIX_NANOTIME:
+        return static_cast<int64_t>(ts / 1000000);
+    default: // NT_TIMESTAMP_TYPE_NATIVE counts from adapter start
+        return 0;
+    }
+}
+
+double timestampToSeconds(const uint64_t ts, const enum NtTimestampType_e type)
+{
+    switch (type)
+    {
+    case NT_TIMESTAMP_TYPE_NATIVE:
+    case NT_TIMESTAMP_TYPE_NATIVE_UNIX:
+    case NT_TIMESTAMP_TYPE_NATIVE_NDIS:
+        return ts * 1e-8;
+    case NT_TIMESTAMP_TYPE_NDIS:
+        return ts * 1e-7;
+    case NT_TIMESTAMP_TYPE_PCAP:
+        return (ts & 0xffffffff) + (ts >> 32) * 1e-6;
+    case NT_TIMESTAMP_TYPE_PCAP_NANOTIME:
+        return (ts & 0xffffffff) + (ts >> 32) * 1e-9;
+    case NT_TIMESTAMP_TYPE_UNIX_NANOTIME:
+        return ts * 1e-9;
+    default:
+        return 0;
+    }
+}
+
+// Drops time stamps of an adapter clock that isn't synchronized to the host
+static int64_t checkedTimestamp(const uint64_t ts, const enum NtTimestampType_e type, const int64_t now_ms)
+{
+    const int64_t unix_ms = timestampToUnixMs(ts, type);
+
+    if (unix_ms <= 0 || std::llabs(unix_ms - now_ms) > TIMESTAMP_MAX_SKEW_MS)
+        return 0;
+
+    return unix_ms;
+}
+
+void updateSampleTimestamps(const NtStatistics_t &hStat, SampleTimestamps &timestamps, const int ports_count,
+                            const int adapters_count)
+{
+    const QueryResult &data = hStat.u.query_v3.data;
+    const int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                               std::chrono::system_clock::now().time_since_epoch())
+                               .count();
+
+    std::lock_guard<std::mutex> guard(timestamps.lock);
+
+    timestamps.ports.assign(ports_count, 0);
+    timestamps.newest_port = 0;
+    for (int p = 0; p < ports_count; p++)
+    {
+        timestamps.ports[p] = checkedTimestamp(data.port.aPorts[p].ts, data.port.aPorts[p].tsType, now_ms);
+        timestamps.newest_port = std::max(timestamps.newest_port, timestamps.ports[p]);
+    }
+
+    timestamps.adapters.assign(adapters_count, 0);
+    for (int a = 0; a < adapters_count; a++)
+    {
+        const struct NtStatGroupColor_s &color = data.adapter.aAdapters[a].color;
+        if (color.supported)
+            timestamps.adapters[a] = checkedTimestamp(color.ts, color.tsType, now_ms);
+    }
+
+    // stream.ts carries no type of its own, it follows the adapter TimestampFormat like the port time stamps
+    timestamps.streams = ports_count > 0 ? checkedTimestamp(data.stream.ts, data.port.aPorts[0].tsType, now_ms) : 0;
+}
+
+static const std::string *labelValue(const ClientMetric &metric, const char *name)
+{
+    for (const ClientMetric::Label &label : metric.label)
+    {
+        if (label.name == name)
+            return &label.value;
+    }
+
+    return nullptr;
+}
+
+static int64_t indexedTimestamp(const std::vector<int64_t> &timestamps, const std::string &index)
+{
+    const size_t i = std::strtoul(index.c_str(), nullptr, 10);
+    return i < timestamps.size() ? timestamps[i] : 0;
+}
+
+// Families holding series sampled from the QUERY_V3 read, and within napatech_stat_total and napatech_stat the type
+// labels of those series. Burst peaks, window companions, link, NUMA, usage, flow, loss and scheduler series come from
+// other reads or the exporter itself and are left without a time stamp.
+static const char *const SAMPLED_FAMILIES[] = {"napatech_stat_total", "napatech_stat"};
+static const char *const SAMPLED_TYPES[] = {"pkts_count", "bytes_count", "pkts_rate", "bytes_rate", "ratio"};
+static const char *const SAMPLED_HISTOGRAM = "napatech_port_packet_size_bytes";
+
+static bool sampledSeries(const MetricFamily &family, const ClientMetric &metric)
+{
+    if (family.name == SAMPLED_HISTOGRAM)
+        return true;
+
+    if (std::find(std::begin(SAMPLED_FAMILIES), std::end(SAMPLED_FAMILIES), family.name) == std::end(SAMPLED_FAMILIES))
+        return false;
+
+    // Host-buffer usage also counts pkts_count and bytes_count, from its own read
+    if (labelValue(metric, "host_buffer") != nullptr)
+        return false;
+
+    for (const char *type : SAMPLED_TYPES)
+    {
+        if (labelValue(metric, type) != nullptr)
+            return true;
+    }
+
+    return false;
+}
+
+// Port series carry "port", color series "adapter" and "color", stream series "stream_id", stream rollups
+// "rollup" and stream_id="all" and port rollups "rollup" alone
+static int64_t seriesTimestamp(const MetricFamily &family, const ClientMetric &metric,
+                               const SampleTimestamps &timestamps)
+{
+    const std::string *value;
+
+    if (!sampledSeries(family, metric))
+        return 0;
+
+    if ((value = labelValue(metric, "port")) != nullptr)
+        return indexedTimestamp(timestamps.ports, *value);
+
+    if (labelValue(metric, "color") != nullptr && (value = labelValue(metric, "adapter")) != nullptr)
+        return indexedTimestamp(timestamps.adapters, *value);
+
+    if (labelValue(metric, "stream_id") != nullptr)
+        return timestamps.streams;
+
+    if (labelValue(metric, "rollup") != nullptr)
+        return timestamps.newest_port;
+
+    return 0;
+}
+
+TimestampedCollectable::TimestampedCollectable(std::shared_ptr<Registry> registry, SampleTimestamps &timestamps,
+                                               const bool hide_ports)
+    : registry_(registry), timestamps_(timestamps), hide_ports_(hide_ports)
+{
+}
+
+std::vector<MetricFamily> TimestampedCollectable::Collect() const
+{
+    std::vector<MetricFamily> families = registry_->Collect();
+    std::lock_guard<std::mutex> guard(timestamps_.lock);
+
+    for (MetricFamily &family : families)
+    {
+        if (hide_ports_)
+        {
+            family.metric.erase(std::remove_if(family.metric.begin(), family.metric.end(),
+                                               [](const ClientMetric &metric) {
+                                                   return labelValue(metric, "port") != nullptr;
+                                               }),
+                                family.metric.end());
+        }
+        for (ClientMetric &metric : family.metric)
+            metric.timestamp_ms = seriesTimestamp(family, metric, timestamps_);
+    }
+
+    return families;
+}
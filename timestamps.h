@@ -0,0 +1,53 @@
+#pragma once
+
+#include <prometheus/collectable.h>
+#include <prometheus/metric_family.h>
+#include <prometheus/registry.h>
+#include <napatech/nt.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace prometheus;
+
+// Samples whose hardware time stamp is further than this from the host clock are exported without one,
+// Prometheus rejects samples too far out of its head block and an unsynchronized adapter clock is no better
+const int64_t TIMESTAMP_MAX_SKEW_MS = 5 * 60 * 1000;
+
+// Converts a counter sample time stamp to Unix milliseconds, 0 when the type has no wall-clock base
+int64_t timestampToUnixMs(const uint64_t ts, const enum NtTimestampType_e type);
+
+// Seconds since the base of the time stamp type at full resolution, only differences of the same type are meaningful
+double timestampToSeconds(const uint64_t ts, const enum NtTimestampType_e type);
+
+// Unix milliseconds of the hardware samples behind the QUERY_V3 series, 0 when unknown
+struct SampleTimestamps
+{
+    std::mutex lock;               // Written by the collection loop, read on scrape
+    std::vector<int64_t> ports;    // aPorts[p].ts
+    std::vector<int64_t> adapters; // aAdapters[a].color.ts
+    int64_t streams;               // stream.ts
+    int64_t newest_port;           // Newest of ports, for the port rollups summed over them
+};
+
+// Takes the time stamps of the last QUERY_V3 read
+void updateSampleTimestamps(const NtStatistics_t &hStat, SampleTimestamps &timestamps, const int ports_count,
+                            const int adapters_count);
+
+// Exposes a registry with the hardware sample time of the port, stream, color and rollup series of the QUERY_V3 read
+// attached, so rate() runs over adapter sampling intervals instead of the collection loop and scrape jitter.
+// With hide_ports, series carrying a "port" label are left out and only their adapter and host rollups remain.
+class TimestampedCollectable : public Collectable
+{
+public:
+    TimestampedCollectable(std::shared_ptr<Registry> registry, SampleTimestamps &timestamps, const bool hide_ports);
+
+    std::vector<MetricFamily> Collect() const override;
+
+private:
+    std::shared_ptr<Registry> registry_;
+    SampleTimestamps &timestamps_;
+    bool hide_ports_;
+};
@@ -0,0 +1,269 @@
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "usage.h"
+#include "metrics.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace prometheus;
+
+#define HOST_BUFFER_COUNTER(field, type, name) \
+    { offsetof(HostBufferUsage, field), type, name, ALWAYS_VALID }
+
+const CounterDescriptor HOST_BUFFER_COUNTERS[] = {
+    HOST_BUFFER_COUNTER(deQueued, "hb_bytes", "dequeued"),
+    HOST_BUFFER_COUNTER(enQueued, "hb_bytes", "enqueued"),
+    HOST_BUFFER_COUNTER(enQueuedAdapter, "hb_bytes", "enqueued_adapter"),
+    HOST_BUFFER_COUNTER(hostBufferSize, "hb_bytes", "size"),
+    HOST_BUFFER_COUNTER(onboardBuffering.used, "hb_bytes", "onboard_used"),
+    HOST_BUFFER_COUNTER(onboardBuffering.size, "hb_bytes", "onboard_size"),
+    HOST_BUFFER_COUNTER(stat.rx.frames, "pkts_count", "hb_rx"),
+    HOST_BUFFER_COUNTER(stat.rx.bytes, "bytes_count", "hb_rx"),
+    HOST_BUFFER_COUNTER(stat.drop.frames, "pkts_count", "hb_drop"),
+    HOST_BUFFER_COUNTER(stat.drop.bytes, "bytes_count", "hb_drop"),
+};
+const size_t HOST_BUFFER_COUNTERS_COUNT = sizeof(HOST_BUFFER_COUNTERS) / sizeof(HOST_BUFFER_COUNTERS[0]);
+
+// Ratios exported after HOST_BUFFER_COUNTERS
+static const char *HOST_BUFFER_RATIOS[] = {"fill", "onboard_fill"};
+static const size_t HOST_BUFFER_RATIOS_COUNT = sizeof(HOST_BUFFER_RATIOS) / sizeof(HOST_BUFFER_RATIOS[0]);
+
+// Lag analysis exported after the ratios
+static const char *HOST_BUFFER_LAGS[][2] = {
+    {"hb_seconds", "dwell"},       // Bytes held by the application divided by the receive rate
+    {"hb_seconds", "to_overflow"}, // Free space divided by the fill slope, +Inf while the buffer doesn't fill up
+    {"hb_bytes_rate", "fill_slope"},
+};
+static const size_t HOST_BUFFER_LAGS_COUNT = sizeof(HOST_BUFFER_LAGS) / sizeof(HOST_BUFFER_LAGS[0]);
+
+static inline double fillRatio(const uint64_t used, const uint64_t size)
+{
+    return size != 0 ? static_cast<double>(used) / size : 0.0;
+}
+
+static HostBufferSeries bindHostBuffer(Family<Gauge> &gauge_family, WindowAggregator &windows, const HostBufferKey &key)
+{
+    const Labels labels = {{"stream_id", std::to_string(std::get<0>(key))},
+                           {"host_buffer", std::to_string(std::get<1>(key))},
+                           {"adapter", std::to_string(std::get<2>(key))},
+                           {"numa_node", std::to_string(std::get<3>(key))}};
+    HostBufferSeries series;
+
+    for (size_t c = 0; c < HOST_BUFFER_COUNTERS_COUNT; c++)
+    {
+        Labels counter_labels = labels;
+        counter_labels[HOST_BUFFER_COUNTERS[c].type] = HOST_BUFFER_COUNTERS[c].name;
+        series.gauges.push_back(&gauge_family.Add(counter_labels));
+    }
+
+    for (size_t r = 0; r < HOST_BUFFER_RATIOS_COUNT; r++)
+    {
+        Labels ratio_labels = labels;
+        ratio_labels["hb_ratio"] = HOST_BUFFER_RATIOS[r];
+        series.gauges.push_back(&gauge_family.Add(ratio_labels));
+        series.windows.push_back(addWindowSeries(windows, series.gauges.back(), ratio_labels));
+    }
+
+    for (size_t l = 0; l < HOST_BUFFER_LAGS_COUNT; l++)
+    {
+        Labels lag_labels = labels;
+        lag_labels[HOST_BUFFER_LAGS[l][0]] = HOST_BUFFER_LAGS[l][1];
+        series.gauges.push_back(&gauge_family.Add(lag_labels));
+    }
+
+    series.previous_read = std::chrono::steady_clock::time_point();
+    series.previous_dequeued = 0;
+    series.previous_rx_bytes = 0;
+    series.fill_slope = 0;
+
+    return series;
+}
+
+// Updates the lag gauges, which follow the fill ratios in series.gauges
+static void analyzeLag(HostBufferSeries &series, const HostBufferUsage &hb, const std::chrono::steady_clock::time_point now)
+{
+    Gauge *const *gauge = series.gauges.data() + HOST_BUFFER_COUNTERS_COUNT + HOST_BUFFER_RATIOS_COUNT;
+    const bool first = series.previous_read == std::chrono::steady_clock::time_point();
+    const double elapsed = std::chrono::duration<double>(now - series.previous_read).count();
+    const double slope = (static_cast<double>(hb.deQueued) - series.previous_dequeued) / elapsed;
+    const uint64_t received = counterDelta(hb.stat.rx.bytes, series.previous_rx_bytes);
+
+    series.previous_read = now;
+    series.previous_dequeued = hb.deQueued;
+    if (first)
+        gauge[1]->Set(std::numeric_limits<double>::infinity());
+    if (first || elapsed <= 0)
+        return;
+
+    const double rx_rate = received / elapsed;
+    const double free_bytes = hb.hostBufferSize > hb.deQueued ? hb.hostBufferSize - hb.deQueued : 0;
+
+    series.fill_slope += HOST_BUFFER_SLOPE_SMOOTHING * (slope - series.fill_slope);
+    gauge[0]->Set(rx_rate > 0 ? hb.deQueued / rx_rate : 0);
+    gauge[1]->Set(series.fill_slope > 0 ? free_bytes / series.fill_slope : std::numeric_limits<double>::infinity());
+    gauge[2]->Set(series.fill_slope);
+}
+
+static void runUsageWorker(UsageWorker &worker, Family<Gauge> &gauge_family, const unsigned long cycle)
+{
+    char errorBuffer[NT_ERRBUF_SIZE];
+    int status;
+
+    for (const int stream_id : worker.stream_ids)
+    {
+        worker.hStat->cmd = NT_STATISTICS_READ_CMD_USAGE_DATA_V0;
+        worker.hStat->u.usageData_v0.streamid = static_cast<uint8_t>(stream_id);
+
+        if ((status = NT_StatRead(worker.hStatStream, worker.hStat.get())) != NT_SUCCESS)
+        {
+            NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+            fprintf(stderr, "NT_StatRead() usage data of stream %d failed: %s\n", stream_id, errorBuffer);
+
+            // Keep the stream's series until it is actually gone
+            for (auto series = worker.series.lower_bound(HostBufferKey(stream_id, 0, 0, 0));
+                 series != worker.series.end() && std::get<0>(series->first) == stream_id; ++series)
+                series->second.cycle = cycle;
+            continue;
+        }
+
+        const auto &data = worker.hStat->u.usageData_v0.data;
+        const auto now = std::chrono::steady_clock::now();
+
+        for (uint32_t b = 0; b < data.numHostBufferUsed; b++)
+        {
+            const HostBufferUsage &hb = data.hb[b];
+            const HostBufferKey key(stream_id, b, hb.adapterNo, hb.numaNode);
+            auto series = worker.series.find(key);
+
+            if (series == worker.series.end())
+                series = worker.series.emplace(key, bindHostBuffer(gauge_family, worker.windows, key)).first;
+
+            Gauge *const *gauge = series->second.gauges.data();
+            for (size_t c = 0; c < HOST_BUFFER_COUNTERS_COUNT; c++)
+                (*gauge++)->Set(counterAt(&hb, HOST_BUFFER_COUNTERS[c].offset));
+
+            const double fill = fillRatio(hb.deQueued, hb.hostBufferSize);
+            const double onboard_fill = fillRatio(hb.onboardBuffering.used, hb.onboardBuffering.size);
+            (*gauge++)->Set(fill);
+            (*gauge++)->Set(onboard_fill);
+            observeWindow(worker.windows, series->second.windows[0], fill);
+            observeWindow(worker.windows, series->second.windows[1], onboard_fill);
+            analyzeLag(series->second, hb, now);
+            series->second.cycle = cycle;
+        }
+    }
+
+    // Drop host buffers of streams that went away or moved
+    for (auto series = worker.series.begin(); series != worker.series.end();)
+    {
+        if (series->second.cycle == cycle)
+        {
+            ++series;
+            continue;
+        }
+
+        for (Gauge *gauge : series->second.gauges)
+        {
+            removeWindowSeries(worker.windows, gauge);
+            gauge_family.Remove(gauge);
+        }
+        series = worker.series.erase(series);
+    }
+
+    closeDueWindow(worker.windows);
+}
+
+// Runs the worker once per cycle of processUsageMetrics() until the collector is closed
+static void runUsageThread(UsageCollector &usage, UsageWorker &worker)
+{
+    unsigned long cycle = 0;
+    std::unique_lock<std::mutex> guard(usage.lock);
+
+    for (;;)
+    {
+        usage.wake.wait(guard, [&] { return usage.stopping || usage.cycle != cycle; });
+        if (usage.stopping)
+            return;
+        cycle = usage.cycle;
+
+        guard.unlock();
+        runUsageWorker(worker, *usage.gauge_family, cycle);
+        guard.lock();
+
+        if (--usage.pending == 0)
+            usage.done.notify_one();
+    }
+}
+
+bool openUsageCollector(UsageCollector &usage, Family<Gauge> &gauge_family, const WindowFamilies &window_families,
+                        const int window_ms)
+{
+    char errorBuffer[NT_ERRBUF_SIZE];
+    int status;
+
+    usage.gauge_family = &gauge_family;
+    usage.cycle = 0;
+
+    usage.workers.resize(USAGE_WORKERS_COUNT);
+    for (UsageWorker &worker : usage.workers)
+    {
+        if ((status = NT_StatOpen(&worker.hStatStream, "PrometheusUsageStat")) != NT_SUCCESS)
+        {
+            NT_ExplainError(status, errorBuffer, sizeof(errorBuffer));
+            fprintf(stderr, "NT_StatOpen() failed: %s\n", errorBuffer);
+            return false;
+        }
+        worker.hStat.reset(new NtStatistics_t());
+        openWindowAggregator(worker.windows, window_families, window_ms);
+    }
+
+    // Started once every stream is open, a failed open leaves no thread behind
+    usage.pending = 0;
+    usage.stopping = false;
+    for (UsageWorker &worker : usage.workers)
+        usage.threads.emplace_back(runUsageThread, std::ref(usage), std::ref(worker));
+
+    return true;
+}
+
+void closeUsageCollector(UsageCollector &usage)
+{
+    {
+        std::lock_guard<std::mutex> guard(usage.lock);
+        usage.stopping = true;
+    }
+    usage.wake.notify_all();
+
+    for (std::thread &thread : usage.threads)
+        thread.join();
+
+    for (UsageWorker &worker : usage.workers)
+        NT_StatClose(worker.hStatStream);
+}
+
+void processUsageMetrics(UsageCollector &usage, const std::vector<int> &stream_ids)
+{
+    const size_t workers_count = usage.workers.size();
+
+    for (UsageWorker &worker : usage.workers)
+        worker.stream_ids.clear();
+
+    // A stream ID always lands on the same worker, which owns its series
+    for (const int stream_id : stream_ids)
+        usage.workers[stream_id % workers_count].stream_ids.push_back(stream_id);
+
+    std::unique_lock<std::mutex> guard(usage.lock);
+    usage.cycle++;
+    usage.pending = workers_count;
+    usage.wake.notify_all();
+    usage.done.wait(guard, [&usage] { return usage.pending == 0; });
+}
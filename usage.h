@@ -0,0 +1,81 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include <napatech/nt.h>
+#include "metrics.h"
+#include "window.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace prometheus;
+
+typedef NtStatisticsUsageData_v0_s::NtStatUsageData_s::NtStatHostBufferUsage_s HostBufferUsage;
+
+// Number of threads querying NT_STATISTICS_READ_CMD_USAGE_DATA_V0 in parallel, each with its own stat stream.
+// They are started with the collector and wait for each cycle.
+const int USAGE_WORKERS_COUNT = 4;
+
+// Weight of the newest sample in the smoothed fill slope
+const double HOST_BUFFER_SLOPE_SMOOTHING = 0.3;
+
+// Gauges of one host buffer: HOST_BUFFER_COUNTERS entries followed by the fill ratios and the lag analysis
+struct HostBufferSeries
+{
+    std::vector<Gauge *> gauges;
+    std::vector<size_t> windows; // WindowAggregator slots of the fill ratios
+    unsigned long cycle;         // Last cycle the host buffer was reported in
+
+    // Previous sample, for the lag analysis
+    std::chrono::steady_clock::time_point previous_read;
+    uint64_t previous_dequeued;
+    uint64_t previous_rx_bytes;
+    double fill_slope; // Smoothed growth of the bytes held by the application, per second
+};
+
+// (stream ID, host buffer index, adapter, NUMA node)
+typedef std::tuple<int, int, int, int> HostBufferKey;
+
+struct UsageWorker
+{
+    NtStatStream_t hStatStream;
+    std::unique_ptr<NtStatistics_t> hStat;
+    std::vector<int> stream_ids; // Active stream IDs assigned to this worker for the current cycle
+    std::map<HostBufferKey, HostBufferSeries> series;
+    WindowAggregator windows; // Companions of the fill ratios of this worker's series
+};
+
+struct UsageCollector
+{
+    Family<Gauge> *gauge_family;
+    std::vector<UsageWorker> workers;
+    std::vector<std::thread> threads; // One per worker
+    std::mutex lock;
+    std::condition_variable wake; // A new cycle or stopping
+    std::condition_variable done; // pending reached 0
+    unsigned long cycle;
+    size_t pending; // Workers still running the current cycle
+    bool stopping;
+};
+
+extern const CounterDescriptor HOST_BUFFER_COUNTERS[];
+extern const size_t HOST_BUFFER_COUNTERS_COUNT;
+
+bool openUsageCollector(UsageCollector &usage, Family<Gauge> &gauge_family, const WindowFamilies &window_families,
+                        const int window_ms);
+void closeUsageCollector(UsageCollector &usage);
+
+// Reads the host-buffer usage of the active stream IDs in parallel.
+// Besides the usage itself, every host buffer gets the time its data waits for the application (Little's law over
+// the bytes it holds and its receive rate) and the seconds left before it fills up at the smoothed fill slope.
+// Series of host buffers that are no longer reported are removed.
+// Returns once every worker has finished the cycle.
+void processUsageMetrics(UsageCollector &usage, const std::vector<int> &stream_ids);
@@ -0,0 +1,109 @@
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+#include "window.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <vector>
+
+using namespace prometheus;
+
+static void resetSlot(WindowAggregator &windows, const size_t slot)
+{
+    windows.min[slot] = std::numeric_limits<double>::infinity();
+    windows.max[slot] = -std::numeric_limits<double>::infinity();
+    windows.sum[slot] = 0;
+    windows.count[slot] = 0;
+}
+
+void openWindowAggregator(WindowAggregator &windows, const WindowFamilies &families, const int window_ms)
+{
+    windows.families = families;
+    windows.window = std::chrono::milliseconds(window_ms);
+    windows.window_end = std::chrono::steady_clock::now() + windows.window;
+}
+
+size_t addWindowSeries(WindowAggregator &windows, Gauge *base, const Labels &labels)
+{
+    const auto existing = windows.slots.find(base);
+    if (existing != windows.slots.end())
+        return existing->second;
+
+    size_t slot;
+    if (!windows.free_slots.empty())
+    {
+        slot = windows.free_slots.back();
+        windows.free_slots.pop_back();
+    }
+    else
+    {
+        slot = windows.min.size();
+        windows.min.push_back(0);
+        windows.max.push_back(0);
+        windows.sum.push_back(0);
+        windows.count.push_back(0);
+        windows.min_gauges.push_back(nullptr);
+        windows.max_gauges.push_back(nullptr);
+        windows.avg_gauges.push_back(nullptr);
+    }
+
+    resetSlot(windows, slot);
+    windows.min_gauges[slot] = &windows.families.min->Add(labels);
+    windows.max_gauges[slot] = &windows.families.max->Add(labels);
+    windows.avg_gauges[slot] = &windows.families.avg->Add(labels);
+    windows.slots[base] = slot;
+
+    return slot;
+}
+
+void removeWindowSeries(WindowAggregator &windows, Gauge *base)
+{
+    const auto existing = windows.slots.find(base);
+    if (existing == windows.slots.end())
+        return;
+
+    const size_t slot = existing->second;
+    windows.families.min->Remove(windows.min_gauges[slot]);
+    windows.families.max->Remove(windows.max_gauges[slot]);
+    windows.families.avg->Remove(windows.avg_gauges[slot]);
+    windows.min_gauges[slot] = nullptr;
+    windows.max_gauges[slot] = nullptr;
+    windows.avg_gauges[slot] = nullptr;
+    resetSlot(windows, slot);
+    windows.slots.erase(existing);
+    windows.free_slots.push_back(slot);
+}
+
+void removeStaleWindows(WindowAggregator &windows, const std::vector<Gauge *> &before, const std::vector<Gauge *> &after)
+{
+    for (Gauge *base : before)
+    {
+        if (std::find(after.begin(), after.end(), base) == after.end())
+            removeWindowSeries(windows, base);
+    }
+}
+
+void closeDueWindow(WindowAggregator &windows)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    if (now < windows.window_end)
+        return;
+
+    for (size_t slot = 0; slot < windows.count.size(); slot++)
+    {
+        // Free slots have no gauges
+        if (windows.count[slot] == 0 || windows.min_gauges[slot] == nullptr)
+            continue;
+
+        windows.min_gauges[slot]->Set(windows.min[slot]);
+        windows.max_gauges[slot]->Set(windows.max[slot]);
+        windows.avg_gauges[slot]->Set(windows.sum[slot] / windows.count[slot]);
+        resetSlot(windows, slot);
+    }
+
+    windows.window_end += windows.window * ((now - windows.window_end) / windows.window + 1);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <prometheus/registry.h>
+#include <prometheus/gauge.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+using namespace prometheus;
+
+// Families of the window companions, named after the base family with _min, _max and _avg appended
+struct WindowFamilies
+{
+    Family<Gauge> *min;
+    Family<Gauge> *max;
+    Family<Gauge> *avg;
+};
+
+// Min, max and mean of gauge values over fixed windows, so samples taken between two scrapes still show.
+// Values are kept as a struct of arrays indexed by slot: an observation touches three doubles and a counter,
+// whatever the number of series. One aggregator belongs to one thread.
+struct WindowAggregator
+{
+    WindowFamilies families;
+    std::chrono::steady_clock::duration window;
+    std::chrono::steady_clock::time_point window_end;
+    std::map<Gauge *, size_t> slots; // Base gauge -> slot
+    std::vector<size_t> free_slots;
+
+    std::vector<double> min;
+    std::vector<double> max;
+    std::vector<double> sum;
+    std::vector<uint32_t> count;
+    std::vector<Gauge *> min_gauges;
+    std::vector<Gauge *> max_gauges;
+    std::vector<Gauge *> avg_gauges;
+};
+
+// Slot of a series without window companions
+const size_t NO_WINDOW = static_cast<size_t>(-1);
+
+void openWindowAggregator(WindowAggregator &windows, const WindowFamilies &families, const int window_ms);
+
+// Adds the companions of base, which is exported with labels. A base that already has them keeps its slot.
+size_t addWindowSeries(WindowAggregator &windows, Gauge *base, const Labels &labels);
+
+// Removes the companions of base, if any
+void removeWindowSeries(WindowAggregator &windows, Gauge *base);
+
+// Removes the companions of the bases in before that are no longer in after
+void removeStaleWindows(WindowAggregator &windows, const std::vector<Gauge *> &before, const std::vector<Gauge *> &after);
+
+inline void observeWindow(WindowAggregator &windows, const size_t slot, const double value)
+{
+    windows.min[slot] = std::min(windows.min[slot], value);
+    windows.max[slot] = std::max(windows.max[slot], value);
+    windows.sum[slot] += value;
+    windows.count[slot]++;
+}
+
+// Publishes and restarts the window once it has ended. Series without observations keep their last window.
+void closeDueWindow(WindowAggregator &windows);